@@ -0,0 +1,291 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+namespace benchmark
+{
+	/////////////////////////////
+	/// State Implementation ///
+	/////////////////////////////
+
+	State::State(long long iterations, const std::vector<long long> & args)
+		: maxIterations(iterations), iteration(0), args(args), running(false),
+		  realStart(), cpuStart(0), realTime(0.0), cpuTime(0.0), itemsProcessed(0), counters()
+	{
+	}
+
+	bool State::keepRunning()
+	{
+		if (iteration == 0)
+			startTimer();
+		if (iteration < maxIterations)
+		{
+			++iteration;
+			return true;
+		}
+		stopTimer();
+		return false;
+	}
+
+	void State::pauseTiming()
+	{
+		stopTimer();
+	}
+
+	void State::resumeTiming()
+	{
+		startTimer();
+	}
+
+	void State::startTimer()
+	{
+		running = true;
+		realStart = std::chrono::steady_clock::now();
+		cpuStart = std::clock();
+	}
+
+	void State::stopTimer()
+	{
+		if (!running)
+			return;
+		running = false;
+		realTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+		cpuTime += double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	}
+
+	/////////////////////////////////
+	/// Benchmark Implementation ///
+	/////////////////////////////////
+
+	Benchmark::Benchmark(const std::string & name, Function function)
+		: name(name), function(function), argLists()
+	{
+	}
+
+	Benchmark * Benchmark::arg(long long a)
+	{
+		argLists.push_back(std::vector<long long>(1, a));
+		return this;
+	}
+
+	Benchmark * Benchmark::args(long long a, long long b)
+	{
+		std::vector<long long> list;
+		list.push_back(a);
+		list.push_back(b);
+		argLists.push_back(list);
+		return this;
+	}
+
+	static std::vector<Benchmark*> & registry()
+	{
+		static std::vector<Benchmark*> benchmarks;
+		return benchmarks;
+	}
+
+	Benchmark * registerBenchmark(const std::string & name, Function function)
+	{
+		Benchmark * b = new Benchmark(name, function);
+		registry().push_back(b);
+		return b;
+	}
+
+	// Written by escape() so the compiler has to assume the pointed-to value is used
+	const void * volatile escapeSink = NULL;
+
+	void escape(const void * p)
+	{
+		escapeSink = p;
+	}
+
+	//////////////
+	/// Runner ///
+	//////////////
+
+	// Result of one benchmark at one argument list
+	struct Run
+	{
+		std::string name;
+		long long iterations;
+		double realTime;	// nanoseconds per iteration
+		double cpuTime;		// nanoseconds per iteration
+		double itemsPerSecond;
+		std::vector<std::pair<std::string, double> > counters;
+	};
+
+	static std::string runName(const Benchmark & b, const std::vector<long long> & args)
+	{
+		std::string name = b.name;
+		char buf[32];
+		for (int i = 0; i < args.size(); ++i)
+		{
+			sprintf(buf, "/%lld", args[i]);
+			name += buf;
+		}
+		return name;
+	}
+
+	// Grows the iteration count until a run takes at least minTime seconds.
+	// Benchmarks with untimed setup per iteration also stop once a run takes
+	// ten times that long in total, so cheap kernels don't run for ever
+	static Run runOne(const Benchmark & b, const std::vector<long long> & args, double minTime)
+	{
+		long long iterations = 1;
+		while (true)
+		{
+			State state(iterations, args);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			b.function(state);
+			double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			double seconds = state.realSeconds();
+			if (seconds >= minTime || wall >= 10.0 * minTime || iterations >= 1000000000LL)
+			{
+				Run run;
+				run.name = runName(b, args);
+				run.iterations = iterations;
+				run.realTime = seconds * 1e9 / iterations;
+				run.cpuTime = state.cpuSeconds() * 1e9 / iterations;
+				run.itemsPerSecond = seconds > 0.0 ? state.items() / seconds : 0.0;
+				run.counters = state.userCounters();
+				return run;
+			}
+
+			double multiplier = seconds > 0.0 ? minTime * 1.4 / seconds : 10.0;
+			if (multiplier > 10.0) multiplier = 10.0;
+			if (multiplier < 2.0) multiplier = 2.0;
+			iterations = (long long)(iterations * multiplier);
+		}
+	}
+
+	// Quotes a string for JSON: backslashes (as in Windows paths), quotes and
+	// control characters are escaped
+	static std::string jsonString(const std::string & s)
+	{
+		std::string quoted = "\"";
+		for (int i = 0; i < s.size(); ++i)
+		{
+			unsigned char c = s[i];
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+				quoted += c;
+			}
+			else if (c < 0x20)
+			{
+				char buf[8];
+				sprintf(buf, "\\u%04x", c);
+				quoted += buf;
+			}
+			else
+				quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	static void writeJson(FILE * out, const char * executable, const std::vector<Run> & runs)
+	{
+		char date[64];
+		std::time_t now = std::time(NULL);
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+		fprintf(out, "{\n  \"context\": {\n");
+		fprintf(out, "    \"date\": \"%s\",\n", date);
+		fprintf(out, "    \"executable\": %s,\n", jsonString(executable).c_str());
+		fprintf(out, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+		fprintf(out, "    \"library_build_type\": \"release\"\n");
+#else
+		fprintf(out, "    \"library_build_type\": \"debug\"\n");
+#endif
+		fprintf(out, "  },\n  \"benchmarks\": [\n");
+		for (int i = 0; i < runs.size(); ++i)
+		{
+			const Run & r = runs[i];
+			fprintf(out, "    {\n");
+			fprintf(out, "      \"name\": %s,\n", jsonString(r.name).c_str());
+			fprintf(out, "      \"run_name\": %s,\n", jsonString(r.name).c_str());
+			fprintf(out, "      \"iterations\": %lld,\n", r.iterations);
+			fprintf(out, "      \"real_time\": %.6f,\n", r.realTime);
+			fprintf(out, "      \"cpu_time\": %.6f,\n", r.cpuTime);
+			fprintf(out, "      \"time_unit\": \"ns\"");
+			if (r.itemsPerSecond > 0.0)
+				fprintf(out, ",\n      \"items_per_second\": %.6e", r.itemsPerSecond);
+			for (int j = 0; j < r.counters.size(); ++j)
+				fprintf(out, ",\n      %s: %.6e", jsonString(r.counters[j].first).c_str(), r.counters[j].second);
+			fprintf(out, "\n    }%s\n", i + 1 < runs.size() ? "," : "");
+		}
+		fprintf(out, "  ]\n}\n");
+	}
+
+	static const char * option(const char * arg, const char * name)
+	{
+		size_t n = strlen(name);
+		if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+			return arg + n + 1;
+		return NULL;
+	}
+
+	int runBenchmarks(int argc, char ** argv)
+	{
+		std::string filter;
+		std::string outFile;
+		double minTime = 0.5;
+		for (int i = 1; i < argc; ++i)
+		{
+			const char * value;
+			if ((value = option(argv[i], "--benchmark_filter")))
+				filter = value;
+			else if ((value = option(argv[i], "--benchmark_out")))
+				outFile = value;
+			else if ((value = option(argv[i], "--benchmark_min_time")))
+				minTime = atof(value);
+			else
+			{
+				fprintf(stderr, "usage: %s [--benchmark_filter=<substring>] "
+					"[--benchmark_min_time=<seconds>] [--benchmark_out=<file.json>]\n", argv[0]);
+				return 1;
+			}
+		}
+
+		printf("%-48s %15s %15s %12s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations");
+		std::vector<Run> runs;
+		const std::vector<Benchmark*> & benchmarks = registry();
+		for (int i = 0; i < benchmarks.size(); ++i)
+		{
+			const Benchmark & b = *benchmarks[i];
+			std::vector<std::vector<long long> > argLists = b.argLists;
+			if (argLists.empty())
+				argLists.push_back(std::vector<long long>());
+
+			for (int j = 0; j < argLists.size(); ++j)
+			{
+				if (!filter.empty() && runName(b, argLists[j]).find(filter) == std::string::npos)
+					continue;
+				Run r = runOne(b, argLists[j], minTime);
+				printf("%-48s %15.1f %15.1f %12lld", r.name.c_str(), r.realTime, r.cpuTime, r.iterations);
+				for (int k = 0; k < r.counters.size(); ++k)
+					printf(" %s=%g", r.counters[k].first.c_str(), r.counters[k].second);
+				printf("\n");
+				fflush(stdout);
+				runs.push_back(r);
+			}
+		}
+
+		if (!outFile.empty())
+		{
+			FILE * out = fopen(outFile.c_str(), "w");
+			if (!out)
+			{
+				fprintf(stderr, "could not open %s\n", outFile.c_str());
+				return 1;
+			}
+			writeJson(out, argv[0], runs);
+			fclose(out);
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,116 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <utility>
+
+// A minimal microbenchmark harness modelled after Google Benchmark.
+// Benchmarks are plain functions registered with the BENCHMARK macro and
+// optionally parameterized with arg(). They loop on State::keepRunning():
+//
+//	static void BM_Something(benchmark::State & state)
+//	{
+//		setup(state.range(0));
+//		while (state.keepRunning())
+//			work();
+//	}
+//	BENCHMARK(BM_Something)->arg(1000)->arg(100000);
+//
+// The runner accepts --benchmark_filter=<substring>, --benchmark_min_time=<seconds>
+// and --benchmark_out=<file>, the last writes results in Google Benchmark's JSON format
+namespace benchmark
+{
+	// Timing state handed to a running benchmark
+	class State
+	{
+	public:
+		State(long long iterations, const std::vector<long long> & args);
+
+		// Returns true while there are iterations left to run
+		bool keepRunning();
+
+		// The i-th argument this run was registered with
+		long long range(int i = 0) const { return args[i]; }
+		long long iterations() const { return maxIterations; }
+
+		// Excludes setup work inside the loop from the measurement
+		void pauseTiming();
+		void resumeTiming();
+
+		// Number of items (particles, springs...) processed over all iterations
+		void setItemsProcessed(long long items) { itemsProcessed = items; }
+
+		// Reports an extra named value with the result
+		void setCounter(const std::string & name, double value) { counters.push_back(std::make_pair(name, value)); }
+		const std::vector<std::pair<std::string, double> > & userCounters() const { return counters; }
+
+		double realSeconds() const { return realTime; }
+		double cpuSeconds() const { return cpuTime; }
+		long long items() const { return itemsProcessed; }
+
+	private:
+		void startTimer();
+		void stopTimer();
+
+		long long maxIterations;
+		long long iteration;
+		std::vector<long long> args;
+		bool running;
+		std::chrono::steady_clock::time_point realStart;
+		std::clock_t cpuStart;
+		double realTime;
+		double cpuTime;
+		long long itemsProcessed;
+		std::vector<std::pair<std::string, double> > counters;
+	};
+
+	typedef void (*Function)(State &);
+
+	// A registered benchmark and the argument lists it should run with
+	class Benchmark
+	{
+	public:
+		Benchmark(const std::string & name, Function function);
+
+		// Adds a run with a single argument
+		Benchmark * arg(long long a);
+
+		// Adds a run with two arguments
+		Benchmark * args(long long a, long long b);
+
+		std::string name;
+		Function function;
+		std::vector<std::vector<long long> > argLists;
+	};
+
+	// Adds a benchmark to the global list, used by the BENCHMARK macro
+	Benchmark * registerBenchmark(const std::string & name, Function function);
+
+	// Out-of-line sink used by doNotOptimize on compilers without inline asm
+	void escape(const void * p);
+
+	// Keeps the compiler from discarding a computed value
+	template <class T>
+	inline void doNotOptimize(const T & value)
+	{
+#if defined(__GNUC__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		escape(&value);
+#endif
+	}
+
+	// Runs all registered benchmarks matching the command line, returns the exit code
+	int runBenchmarks(int argc, char ** argv);
+}
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+#define BENCHMARK(function) \
+	static benchmark::Benchmark * BENCHMARK_CONCAT(benchmark_, __LINE__) = \
+		benchmark::registerBenchmark(#function, function)
+
+#endif
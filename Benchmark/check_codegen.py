@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+"""Checks that the spring and integration kernels compile to call-free vector code.
+
+usage: check_codegen.py [compiler] [extra flags...]
+
+Compiles ParticleSystem/particlesystem.cpp to assembly (default: c++ -O2) and,
+for each kernel below, fails if its body still calls a function (a Vector3
+operator or force helper that didn't inline) or uses no packed double
+instructions. Needs a GCC or Clang style compiler and c++filt.
+"""
+import os
+import re
+import subprocess
+import sys
+
+KERNELS = [
+    "ParticleSystemSpringMass::computeSpringForces()",
+    "ParticleSystemSpringMass::gatherSpringForces()",
+    "Particle::update(double)",
+]
+
+PACKED = re.compile(r"^\s+v?(add|sub|mul|div|fmadd\w*|fnmadd\w*)pd\b")
+CALL = re.compile(r"^\s+(call|jmp)\w*\s+[A-Za-z_]")
+
+
+def assembly(compiler, flags):
+    here = os.path.dirname(os.path.abspath(__file__))
+    source = os.path.join(here, "..", "ParticleSystem", "particlesystem.cpp")
+    asm = subprocess.check_output([compiler, "-std=c++11", "-O2", "-S", "-o", "-"] + flags + [source])
+    return subprocess.check_output(["c++filt"], input=asm).decode()
+
+
+def body(asm, name):
+    lines = asm.splitlines()
+    for i, line in enumerate(lines):
+        if line == name + ":":
+            end = i + 1
+            while end < len(lines) and ".cfi_endproc" not in lines[end]:
+                end += 1
+            return lines[i + 1:end]
+    return None
+
+
+def main(argv):
+    compiler = argv[1] if len(argv) > 1 else os.environ.get("CXX", "c++")
+    asm = assembly(compiler, argv[2:])
+
+    failed = False
+    for name in KERNELS:
+        lines = body(asm, name)
+        if lines is None:
+            print("%-50s not found" % name)
+            failed = True
+            continue
+        calls = [l.strip() for l in lines if CALL.match(l)]
+        packed = len([l for l in lines if PACKED.match(l)])
+        ok = not calls and packed > 0
+        print("%-50s %s  (%d instructions, %d packed, %d calls)" % (name, "ok" if ok else "FAIL", len(lines), packed, len(calls)))
+        for c in calls:
+            print("    " + c)
+        failed = failed or not ok
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+"""Compares two benchmark JSON files and flags regressions.
+
+usage: compare.py baseline.json contender.json [--threshold=0.05] [--metric=real_time]
+
+A benchmark regresses when its time in the contender is more than 'threshold'
+(a fraction, 0.05 = 5%) above the baseline. Exits with status 1 if any
+benchmark regressed so it can gate a build.
+"""
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return dict((b["name"], b) for b in data["benchmarks"])
+
+
+def main(argv):
+    threshold = 0.05
+    metric = "real_time"
+    files = []
+    for arg in argv[1:]:
+        if arg.startswith("--threshold="):
+            threshold = float(arg.split("=", 1)[1])
+        elif arg.startswith("--metric="):
+            metric = arg.split("=", 1)[1]
+        else:
+            files.append(arg)
+    if len(files) != 2:
+        sys.stderr.write(__doc__)
+        return 2
+
+    baseline = load(files[0])
+    contender = load(files[1])
+
+    regressions = 0
+    print("%-48s %15s %15s %9s" % ("Benchmark", "Baseline", "Contender", "Change"))
+    for name in baseline:
+        if name not in contender:
+            print("%-48s %15s" % (name, "missing"))
+            continue
+        old = baseline[name][metric]
+        new = contender[name][metric]
+        change = (new - old) / old if old > 0 else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  improved"
+        print("%-48s %15.1f %15.1f %+8.1f%%%s" % (name, old, new, change * 100, flag))
+    for name in contender:
+        if name not in baseline:
+            print("%-48s %15s" % (name, "new"))
+
+    if regressions:
+        print("\n%d benchmark(s) regressed by more than %.1f%%" % (regressions, threshold * 100))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,542 @@
+#include "benchmark.h"
+
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "../ParticleSystem/const.h"
+#include "../ParticleSystem/vector3.h"
+#include "../ParticleSystem/particlesystem.h"
+#include "../ParticleSystem/player.h"
+#include "../ParticleSystem/taskgraph.h"
+
+// Number of springs in one default ParticleSystemSpringMass (10x10 grid)
+const int SPRINGS_PER_SYSTEM = 342;
+
+double randDouble(double min, double max)
+{
+	return rand() / static_cast<double>(RAND_MAX) * (max - min) + min;
+}
+
+static std::vector<Vector3> randomVectors(long long n)
+{
+	srand(1);
+	std::vector<Vector3> v(n);
+	for (int i = 0; i < n; ++i)
+		v[i] = Vector3(randDouble(-1, 1), randDouble(-1, 1), randDouble(-1, 1));
+	return v;
+}
+
+// Enough spring-mass systems to hold about 'springs' springs
+static std::vector<ParticleSystem*> springMassSystems(long long springs)
+{
+	std::vector<ParticleSystem*> psystems;
+	long long count = (springs + SPRINGS_PER_SYSTEM - 1) / SPRINGS_PER_SYSTEM;
+	for (int i = 0; i < count; ++i)
+		psystems.push_back(new ParticleSystemSpringMass(Vector3(100.0 + i % 600, 0.0, 0.0)));
+	return psystems;
+}
+
+static void deleteSystems(std::vector<ParticleSystem*> & psystems)
+{
+	for (int i = 0; i < psystems.size(); ++i)
+		delete psystems[i];
+	psystems.clear();
+}
+
+// A particle system with no behaviour of its own, used to exercise the base class
+class TimedParticleSystem : public ParticleSystem
+{
+public:
+	virtual void init() {}
+};
+
+// Fills a system with n particles and runs it to the point where 'expiredPercent'
+// of them have just run out of time, so the next cleanup has to remove them
+static void fillTimed(ParticleSystem & ps, long long n, long long expiredPercent)
+{
+	ps.particles.reserve(n);
+	for (int i = 0; i < n; ++i)
+	{
+		double timer = (i * 100 / n) < expiredPercent ? 0.5 : 10.0;
+		ps.addParticle(new Particle(Vector3(), Vector3(), Vector3(), 1.0, timer));
+	}
+	ps.update(0.6);
+}
+
+///////////////
+/// Vector3 ///
+///////////////
+
+static void BM_Vector3Add(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> b = randomVectors(state.range(0));
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < a.size(); ++i)
+			a[i] += b[i];
+		benchmark::doNotOptimize(a[0]);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Add)->arg(1024)->arg(65536);
+
+static void BM_Vector3Axpy(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> b = randomVectors(state.range(0));
+	const double dt = FRAME_DT;
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < a.size(); ++i)
+			a[i] += b[i] * dt;
+		benchmark::doNotOptimize(a[0]);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Axpy)->arg(1024)->arg(65536);
+
+static void BM_Vector3Dot(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> b = randomVectors(state.range(0));
+	while (state.keepRunning())
+	{
+		double sum = 0.0;
+		for (int i = 0; i < a.size(); ++i)
+			sum += a[i].dot(b[i]);
+		benchmark::doNotOptimize(sum);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Dot)->arg(1024)->arg(65536);
+
+static void BM_Vector3Cross(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> b = randomVectors(state.range(0));
+	std::vector<Vector3> c(a.size());
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < a.size(); ++i)
+			c[i] = a[i].cross(b[i]);
+		benchmark::doNotOptimize(c[0]);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Cross)->arg(1024)->arg(65536);
+
+static void BM_Vector3Normalized(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> c(a.size());
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < a.size(); ++i)
+			c[i] = a[i].normalized();
+		benchmark::doNotOptimize(c[0]);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Normalized)->arg(1024)->arg(65536);
+
+static void BM_Vector3Rotate(benchmark::State & state)
+{
+	std::vector<Vector3> a = randomVectors(state.range(0));
+	std::vector<Vector3> c(a.size());
+	const Vector3 axis = Vector3(1.0, 1.0, 0.0).normalized();
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < a.size(); ++i)
+			c[i] = a[i].rotate(axis, PI / 4);
+		benchmark::doNotOptimize(c[0]);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Vector3Rotate)->arg(1024)->arg(65536);
+
+//////////////////////////
+/// Springs and update ///
+//////////////////////////
+
+// SpringJoint::calculateSpringForce over every spring, nothing applied
+static void BM_SpringForce(benchmark::State & state)
+{
+	std::vector<ParticleSystem*> psystems = springMassSystems(state.range(0));
+	long long springs = 0;
+	while (state.keepRunning())
+	{
+		Vector3 total;
+		springs = 0;
+		for (int i = 0; i < psystems.size(); ++i)
+		{
+			ParticleSystemSpringMass * s = static_cast<ParticleSystemSpringMass*>(psystems[i]);
+			for (int j = 0; j < s->springConnections.size(); ++j)
+				total += s->springConnections[j].calculateSpringForce();
+			springs += s->springConnections.size();
+		}
+		benchmark::doNotOptimize(total);
+	}
+	state.setItemsProcessed(state.iterations() * springs);
+	deleteSystems(psystems);
+}
+BENCHMARK(BM_SpringForce)->arg(10000)->arg(100000)->arg(1000000);
+
+// A full ParticleSystemSpringMass::update, second argument selects
+// scatter (0) or CSR gather (1) spring forces
+static void BM_SpringMassUpdate(benchmark::State & state)
+{
+	std::vector<ParticleSystem*> psystems = springMassSystems(state.range(0));
+	for (int i = 0; i < psystems.size(); ++i)
+		static_cast<ParticleSystemSpringMass*>(psystems[i])->gatherForces = state.range(1) != 0;
+
+	const double dt = FRAME_DT;
+	while (state.keepRunning())
+		updateParticleSystems(psystems, dt);
+	state.setItemsProcessed(state.iterations() * psystems.size() * SPRINGS_PER_SYSTEM);
+	deleteSystems(psystems);
+}
+BENCHMARK(BM_SpringMassUpdate)
+	->args(10000, 0)->args(10000, 1)
+	->args(100000, 0)->args(100000, 1)
+	->args(1000000, 0)->args(1000000, 1)
+	->args(10000000, 0)->args(10000000, 1);
+
+// Spring-mass systems stepped at reduced detail, the second argument is
+// reducedInterval (0 = full detail)
+static void BM_ReducedDetail(benchmark::State & state)
+{
+	std::vector<ParticleSystem*> psystems = springMassSystems(state.range(0));
+	for (int i = 0; i < psystems.size() && state.range(1) > 0; ++i)
+	{
+		ParticleSystemSpringMass* ps = static_cast<ParticleSystemSpringMass*>(psystems[i]);
+		ps->reducedInterval = (int)state.range(1);
+		ps->setDetail(ParticleSystemSpringMass::DETAIL_REDUCED);
+	}
+
+	const double dt = FRAME_DT;
+	while (state.keepRunning())
+		updateParticleSystems(psystems, dt);
+	state.setItemsProcessed(state.iterations() * psystems.size() * SPRINGS_PER_SYSTEM);
+	deleteSystems(psystems);
+}
+BENCHMARK(BM_ReducedDetail)->args(100000, 0)->args(100000, 2)->args(100000, 4)->args(100000, 8);
+
+// One large grid, second argument picks the particle order: 0 as built by init(),
+// 1 randomly scattered, 2 scattered then Morton reordered, 3 scattered then RCM reordered.
+// spring_span is the average index distance between the ends of a spring
+static void BM_SpringMassReorder(benchmark::State & state)
+{
+	ParticleSystemSpringMass ps(Vector3(), (int)state.range(0));
+	if (state.range(1) > 0)
+	{
+		std::vector<int> order(ps.particles.size());
+		for (int i = 0; i < order.size(); ++i)
+			order[i] = i;
+		srand(1);
+		for (int i = order.size() - 1; i > 0; --i)
+			std::swap(order[i], order[rand() % (i + 1)]);
+		ps.reorder(order);
+	}
+	if (state.range(1) == 2)
+		ps.reorder(ParticleSystemSpringMass::REORDER_MORTON);
+	if (state.range(1) == 3)
+		ps.reorder(ParticleSystemSpringMass::REORDER_RCM);
+
+	while (state.keepRunning())
+		ps.update(FRAME_DT);
+	state.setItemsProcessed(state.iterations() * ps.springConnections.size());
+	state.setCounter("spring_span", ps.springSpan());
+}
+BENCHMARK(BM_SpringMassReorder)
+	->args(100, 0)->args(100, 1)->args(100, 2)->args(100, 3)
+	->args(1000, 0)->args(1000, 1)->args(1000, 2)->args(1000, 3);
+
+// Implicit steps of one stiff grid (stiffness 1e5, the scene uses 1.8) with
+// the first column locked like a strand on the floor. Second argument picks the
+// preconditioner: 0 Jacobi, 1 multigrid. cg_iterations is per solve
+static void BM_ImplicitStep(benchmark::State & state)
+{
+	ParticleSystemSpringMass ps(Vector3(), (int)state.range(0));
+	ps.colliders = NULL;
+	for (int i = 0; i < ps.springConnections.size(); ++i)
+		ps.springConnections[i].stiffness = 1e5;
+	ps.rebuildAdjacency();
+	srand(1);
+	for (int i = 0; i < ps.particles.size(); ++i)
+	{
+		ps.particles[i]->vel = Vector3(randDouble(-50, 50), randDouble(-50, 50), 0.0);
+		ps.particles[i]->isLocked = i % ps.gridSize == 0;
+	}
+	ps.integrator = ParticleSystemSpringMass::INTEGRATE_IMPLICIT;
+	ps.solver.preconditioner = state.range(1) != 0 ? SpringSolver::PRECONDITION_MULTIGRID : SpringSolver::PRECONDITION_JACOBI;
+	ps.solver.maxIterations = 100000;
+
+	// The first step builds the solver
+	const double dt = FRAME_DT;
+	ps.update(dt);
+	long long iterations = 0;
+	while (state.keepRunning())
+	{
+		ps.update(dt);
+		iterations += ps.solver.lastIterations();
+	}
+	state.setItemsProcessed(state.iterations() * ps.particles.size());
+	state.setCounter("cg_iterations", (double)iterations / state.iterations());
+}
+BENCHMARK(BM_ImplicitStep)->args(100, 0)->args(100, 1)->args(300, 0)->args(300, 1);
+
+// Particle::update, the integration alone
+static void BM_ParticleUpdate(benchmark::State & state)
+{
+	const long long n = state.range(0);
+	std::vector<Particle> particles(n);
+	srand(1);
+	for (int i = 0; i < n; ++i)
+	{
+		particles[i].pos = Vector3(randDouble(1, WINDOW_WIDTH - 1), randDouble(1, WINDOW_HEIGHT - 1), 0.0);
+		particles[i].vel = Vector3(10.0, 0.0, 0.0);
+		particles[i].acc = Vector3(0.0, 14.0, 0.0);
+	}
+
+	const double dt = FRAME_DT;
+	while (state.keepRunning())
+	{
+		for (int i = 0; i < n; ++i)
+			particles[i].update(dt);
+		benchmark::doNotOptimize(particles[0].pos);
+	}
+	state.setItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_ParticleUpdate)->arg(10000)->arg(100000);
+
+//////////////////
+/// Collisions ///
+//////////////////
+
+// Player::lineCollision against random segments in the window
+static void BM_LineCollision(benchmark::State & state)
+{
+	Player ball(Vector3(WINDOW_WIDTH / 2.0, WINDOW_HEIGHT / 2.0, 0.0), 40.0, 20.0);
+	std::vector<Vector3> a(state.range(0));
+	std::vector<Vector3> b(state.range(0));
+	srand(1);
+	for (int i = 0; i < a.size(); ++i)
+	{
+		a[i] = Vector3(randDouble(0, WINDOW_WIDTH), randDouble(0, WINDOW_HEIGHT), 0.0);
+		b[i] = a[i] + Vector3(randDouble(-10, 10), randDouble(-10, 10), 0.0);
+	}
+
+	while (state.keepRunning())
+	{
+		int hits = 0;
+		for (int i = 0; i < a.size(); ++i)
+			hits += ball.lineCollision(a[i], b[i]);
+		benchmark::doNotOptimize(hits);
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LineCollision)->arg(1024)->arg(65536);
+
+// The window edges (defaultColliders) with 'wallPercent' of the particles past
+// the right edge, the pass costs the same however many are
+static void BM_WindowColliders(benchmark::State & state)
+{
+	const long long n = state.range(0);
+	const long long wallPercent = state.range(1);
+	std::vector<Particle*> particles(n);
+	std::vector<Vector3> start(n);
+	srand(1);
+	for (int i = 0; i < n; ++i)
+	{
+		bool atWall = (i * 100 / n) < wallPercent;
+		start[i] = atWall ? Vector3(WINDOW_WIDTH + 1.0, randDouble(1, WINDOW_HEIGHT), 0.0)
+			: Vector3(randDouble(1, WINDOW_WIDTH - 1), randDouble(1, WINDOW_HEIGHT - 1), 0.0);
+		particles[i] = new Particle();
+	}
+
+	while (state.keepRunning())
+	{
+		state.pauseTiming();
+		for (int i = 0; i < n; ++i)
+		{
+			particles[i]->pos = start[i];
+			particles[i]->vel = Vector3(10.0, 0.0, 0.0);
+		}
+		state.resumeTiming();
+
+		defaultColliders().resolve(particles);
+		benchmark::doNotOptimize(particles[0]->pos);
+	}
+	state.setItemsProcessed(state.iterations() * n);
+	for (int i = 0; i < n; ++i)
+		delete particles[i];
+}
+BENCHMARK(BM_WindowColliders)->args(10000, 0)->args(10000, 10)->args(10000, 50)->args(10000, 100);
+
+// One 10x10 strand against 'count' static spheres, capsules and boxes scattered
+// over a 100x larger area, the hierarchy should keep the cost near flat
+static void BM_StaticColliders(benchmark::State & state)
+{
+	std::vector<Collider> shapes;
+	srand(1);
+	for (int i = 0; i < state.range(0); ++i)
+	{
+		Vector3 c(randDouble(0, 100 * WINDOW_WIDTH), randDouble(0, 100 * WINDOW_HEIGHT), 0.0);
+		if (i % 3 == 0)
+			shapes.push_back(Collider::sphere(c, 20.0));
+		else if (i % 3 == 1)
+			shapes.push_back(Collider::capsule(c, c + Vector3(40.0, 10.0, 0.0), 10.0));
+		else
+			shapes.push_back(Collider::box(c, c + Vector3(30.0, 30.0, 30.0)));
+	}
+	ColliderSet colliders;
+	colliders.addStatic(shapes);
+	ParticleSystemSpringMass ps(Vector3(WINDOW_WIDTH / 2.0, WINDOW_HEIGHT / 2.0, 0.0));
+	ps.colliders = &colliders;
+
+	while (state.keepRunning())
+		ps.resolveCollisions();
+	state.setItemsProcessed(state.iterations() * ps.particles.size());
+}
+BENCHMARK(BM_StaticColliders)->arg(0)->arg(100)->arg(10000);
+
+///////////////
+/// Cleanup ///
+///////////////
+
+// ParticleSystem::cleanup on n particles with 'expiredPercent' of them expired,
+// cleanup should cost next to nothing when none are
+static void BM_Cleanup(benchmark::State & state)
+{
+	while (state.keepRunning())
+	{
+		state.pauseTiming();
+		TimedParticleSystem ps;
+		fillTimed(ps, state.range(0), state.range(1));
+		state.resumeTiming();
+
+		ps.cleanup();
+		benchmark::doNotOptimize(ps.particles.size());
+
+		state.pauseTiming();
+	}
+	state.setItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Cleanup)->args(10000, 0)->args(10000, 1)->args(10000, 10)->args(10000, 100);
+
+// cleanupParticleSystems over systems of 100 particles, 'donePercent' of which are empty
+static void BM_CleanupParticleSystems(benchmark::State & state)
+{
+	const long long n = state.range(0);
+	while (state.keepRunning())
+	{
+		state.pauseTiming();
+		std::vector<ParticleSystem*> psystems;
+		for (int i = 0; i < n; ++i)
+		{
+			ParticleSystem * ps = new TimedParticleSystem();
+			fillTimed(*ps, 100, (i * 100 / n) < state.range(1) ? 100 : 0);
+			psystems.push_back(ps);
+		}
+		state.resumeTiming();
+
+		cleanupParticleSystems(psystems);
+		benchmark::doNotOptimize(psystems.size());
+
+		state.pauseTiming();
+		deleteSystems(psystems);
+	}
+	state.setItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_CleanupParticleSystems)->args(1000, 0)->args(1000, 10)->args(1000, 100);
+
+/////////////////////
+/// Frame schedule ///
+/////////////////////
+
+// One frame of update and cleanup over n strands of mixed size (3x3 up to 30x30).
+// Second argument is the number of executor threads running it as a task graph
+// of forces -> bounds -> integrate -> cleanup per system, or 0 for the staged free functions
+static void BM_FrameGraph(benchmark::State & state)
+{
+	const long long n = state.range(0);
+	std::vector<ParticleSystemSpringMass::SpawnParams> params;
+	for (int i = 0; i < n; ++i)
+		params.push_back(ParticleSystemSpringMass::SpawnParams(Vector3(i * 10.0, 0.0, 0.0), 3 + (i * 7) % 28));
+	std::vector<ParticleSystem*> psystems;
+	ParticleSystemSpringMass::spawn(params, psystems);
+
+	const double dt = FRAME_DT;
+	TaskExecutor executor(state.range(1) > 0 ? (int)state.range(1) : 1);
+	TaskGraph graph;
+	while (state.keepRunning())
+	{
+		if (state.range(1) == 0)
+		{
+			updateParticleSystems(psystems, dt);
+			cleanupParticleSystems(psystems);
+			continue;
+		}
+
+		graph.clear();
+		TaskGraph::Task removeDone = graph.add([&]() { removeDoneParticleSystems(psystems); });
+		for (int i = 0; i < psystems.size(); ++i)
+		{
+			ParticleSystem * ps = psystems[i];
+			TaskGraph::Task forces = graph.add([ps, dt]() { ps->applyForces(dt); });
+			TaskGraph::Task bounds = graph.add([ps]() { ps->resolveCollisions(); });
+			TaskGraph::Task integrate = graph.add([ps, dt]() { ps->integrate(dt); });
+			TaskGraph::Task cleanup = graph.add([ps]() { ps->cleanup(); });
+			graph.precede(forces, bounds);
+			graph.precede(bounds, integrate);
+			graph.precede(integrate, cleanup);
+			graph.precede(cleanup, removeDone);
+		}
+		executor.run(graph);
+	}
+	state.setItemsProcessed(state.iterations() * n);
+	deleteSystems(psystems);
+}
+BENCHMARK(BM_FrameGraph)
+	->args(100, 0)->args(100, 1)->args(100, 4)
+	->args(10000, 0)->args(10000, 1)->args(10000, 4);
+
+////////////////
+/// Spawning ///
+////////////////
+
+// Building n default strands, second argument is the number of threads given to
+// ParticleSystemSpringMass::spawn, or 0 for one constructor call per system
+static void BM_Spawn(benchmark::State & state)
+{
+	const long long n = state.range(0);
+	std::vector<ParticleSystemSpringMass::SpawnParams> params;
+	for (int i = 0; i < n; ++i)
+		params.push_back(ParticleSystemSpringMass::SpawnParams(Vector3(i * 100.0, 0.0, 0.0)));
+
+	while (state.keepRunning())
+	{
+		std::vector<ParticleSystem*> psystems;
+		if (state.range(1) == 0)
+			for (int i = 0; i < n; ++i)
+				psystems.push_back(new ParticleSystemSpringMass(params[i].location));
+		else
+			ParticleSystemSpringMass::spawn(params, psystems, (int)state.range(1));
+		benchmark::doNotOptimize(psystems.size());
+
+		state.pauseTiming();
+		deleteSystems(psystems);
+		state.resumeTiming();
+	}
+	state.setItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_Spawn)
+	->args(1000, 0)->args(1000, 1)->args(1000, 4)
+	->args(50000, 0)->args(50000, 1)->args(50000, 4);
+
+int main(int argc, char ** argv)
+{
+	return benchmark::runBenchmarks(argc, argv);
+}
@@ -0,0 +1,401 @@
+#include "collider.h"
+#include "particlesystem.h"
+#include "const.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+////////////////////////////
+/// Aabb Implementation ///
+////////////////////////////
+
+Aabb::Aabb()
+	: lo(INF, INF, INF), hi(-INF, -INF, -INF)
+{
+}
+
+Aabb::Aabb(const Vector3 & lo, const Vector3 & hi)
+	: lo(lo), hi(hi)
+{
+}
+
+void Aabb::expand(const Vector3 & p)
+{
+	lo = Vector3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+	hi = Vector3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+}
+
+void Aabb::expand(const Aabb & b)
+{
+	if (b.isEmpty())
+		return;
+	expand(b.lo);
+	expand(b.hi);
+}
+
+bool Aabb::overlaps(const Aabb & b) const
+{
+	return lo.x <= b.hi.x && b.lo.x <= hi.x &&
+		lo.y <= b.hi.y && b.lo.y <= hi.y &&
+		lo.z <= b.hi.z && b.lo.z <= hi.z;
+}
+
+double Aabb::distance(const Vector3 & p) const
+{
+	Vector3 d(std::max(0.0, std::max(lo.x - p.x, p.x - hi.x)),
+				std::max(0.0, std::max(lo.y - p.y, p.y - hi.y)),
+				std::max(0.0, std::max(lo.z - p.z, p.z - hi.z)));
+	return std::sqrt(d.dot(d));
+}
+
+////////////////////////////////
+/// Collider Implementation ///
+////////////////////////////////
+
+static Collider makeCollider(ColliderShape shape, const Vector3 & a, const Vector3 & b, double radius,
+								double restitution, bool sticky)
+{
+	Collider c;
+	c.shape = shape;
+	c.a = a;
+	c.b = b;
+	c.radius = radius;
+	c.restitution = restitution;
+	c.sticky = sticky;
+	return c;
+}
+
+Collider Collider::plane(const Vector3 & point, const Vector3 & normal, double restitution, bool sticky)
+{
+	return makeCollider(COLLIDER_PLANE, point, normal.normalized(), 0.0, restitution, sticky);
+}
+
+Collider Collider::box(const Vector3 & lo, const Vector3 & hi, double restitution, bool sticky)
+{
+	return makeCollider(COLLIDER_BOX, lo, hi, 0.0, restitution, sticky);
+}
+
+Collider Collider::sphere(const Vector3 & center, double radius, double restitution, bool sticky)
+{
+	return makeCollider(COLLIDER_SPHERE, center, center, radius, restitution, sticky);
+}
+
+Collider Collider::capsule(const Vector3 & a, const Vector3 & b, double radius, double restitution, bool sticky)
+{
+	return makeCollider(COLLIDER_CAPSULE, a, b, radius, restitution, sticky);
+}
+
+Aabb Collider::bounds() const
+{
+	Vector3 r(radius, radius, radius);
+	switch (shape)
+	{
+	case COLLIDER_BOX:
+		return Aabb(a, b);
+	case COLLIDER_SPHERE:
+		return Aabb(a - r, a + r);
+	case COLLIDER_CAPSULE:
+		return Aabb(Vector3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)) - r,
+					Vector3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)) + r);
+	default:
+		return Aabb(Vector3(-INF, -INF, -INF), Vector3(INF, INF, INF));
+	}
+}
+
+///////////////////////////
+/// Narrow phase passes ///
+///////////////////////////
+
+// Moves a particle at signed distance d from a surface with normal n out of it
+// and takes away its velocity into the surface (scaled by bounce = 1 + restitution).
+// The only branch is whether there is a contact, which is rarely the case and
+// so predicted well; a fully branch-free version measured three times slower.
+// The passes copy what they need out of the Collider first, the compiler can't
+// tell it apart from the particles they write to
+static inline void contact(Particle & p, const Vector3 & n, double d, double bounce, bool sticky)
+{
+	if (d > 0.0)
+		return;
+	p.pos.addScaled(n, -d);
+	double vn = std::min(p.vel.dot(n), 0.0);
+	p.vel.addScaled(n, -bounce * vn);
+	p.isLocked = p.isLocked || sticky;
+}
+
+// Planes checked together in one pass over the particles
+const int MAX_PLANES = 16;
+
+// Up to MAX_PLANES planes in one pass, so each particle is loaded once for all of them
+static void collidePlanes(const Collider * const * planes, int count, std::vector<Particle*> & particles)
+{
+	Vector3 normal[MAX_PLANES];
+	double offset[MAX_PLANES];
+	double bounce[MAX_PLANES];
+	bool sticky[MAX_PLANES];
+	for (int k = 0; k < count; ++k)
+	{
+		normal[k] = planes[k]->b;
+		offset[k] = planes[k]->a.dot(planes[k]->b);
+		bounce[k] = 1.0 + planes[k]->restitution;
+		sticky[k] = planes[k]->sticky;
+	}
+
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		Particle & p = *particles[i];
+		for (int k = 0; k < count; ++k)
+			contact(p, normal[k], p.pos.dot(normal[k]) - offset[k], bounce[k], sticky[k]);
+	}
+}
+
+// Spheres and capsules are both a radius around the closest point of a
+// segment, a sphere's segment has zero length
+static void collideCapsule(const Collider & c, std::vector<Particle*> & particles)
+{
+	const Vector3 start = c.a;
+	const Vector3 axis = c.b - c.a;
+	const double radius = c.radius;
+	const double bounce = 1.0 + c.restitution;
+	const bool sticky = c.sticky;
+	double lengthSq = axis.dot(axis);
+	double invLengthSq = lengthSq > 0.0 ? 1.0 / lengthSq : 0.0;
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		Particle & p = *particles[i];
+		double t = std::max(0.0, std::min(1.0, (p.pos - start).dot(axis) * invLengthSq));
+		Vector3 delta = p.pos - (start + axis * t);
+		double dist = delta.magnitude();
+		// A particle exactly on the segment has no direction to be pushed in
+		double invDist = dist > 0.0 ? 1.0 / dist : 0.0;
+		contact(p, delta * invDist, dist - radius, bounce, sticky);
+	}
+}
+
+static void collideBox(const Collider & c, std::vector<Particle*> & particles)
+{
+	const Vector3 lo = c.a;
+	const Vector3 hi = c.b;
+	const double bounce = 1.0 + c.restitution;
+	const bool sticky = c.sticky;
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		Particle & p = *particles[i];
+		// Depth past each face, the particle is inside when all are positive
+		double depth[6] = {
+			p.pos.x - lo.x, hi.x - p.pos.x,
+			p.pos.y - lo.y, hi.y - p.pos.y,
+			p.pos.z - lo.z, hi.z - p.pos.z
+		};
+		int face = 0;
+		for (int k = 1; k < 6; ++k)
+			face = depth[k] < depth[face] ? k : face;
+
+		// Out through the nearest face, the signed distance is positive
+		// (no contact) whenever any face has the particle outside
+		Vector3 n;
+		double s = (face & 1) ? 1.0 : -1.0;
+		n.x = face / 2 == 0 ? s : 0.0;
+		n.y = face / 2 == 1 ? s : 0.0;
+		n.z = face / 2 == 2 ? s : 0.0;
+		contact(p, n, -depth[face], bounce, sticky);
+	}
+}
+
+static void collide(const Collider & c, std::vector<Particle*> & particles)
+{
+	switch (c.shape)
+	{
+	case COLLIDER_PLANE:
+	{
+		const Collider * plane = &c;
+		collidePlanes(&plane, 1, particles);
+		break;
+	}
+	case COLLIDER_BOX:
+		collideBox(c, particles);
+		break;
+	case COLLIDER_SPHERE:
+	case COLLIDER_CAPSULE:
+		collideCapsule(c, particles);
+		break;
+	}
+}
+
+///////////////////////////////////
+/// ColliderSet Implementation ///
+///////////////////////////////////
+
+ColliderSet::ColliderSet()
+	: planes(), statics(), nodes(), dynamics()
+{
+}
+
+void ColliderSet::addStatic(const Collider & c)
+{
+	addStatic(std::vector<Collider>(1, c));
+}
+
+void ColliderSet::addStatic(const std::vector<Collider> & colliders)
+{
+	int before = statics.size();
+	for (int i = 0; i < colliders.size(); ++i)
+	{
+		if (colliders[i].shape == COLLIDER_PLANE)
+			planes.push_back(colliders[i]);
+		else
+			statics.push_back(colliders[i]);
+	}
+	if (statics.size() != before)
+		build();
+}
+
+int ColliderSet::addDynamic(const Collider & c)
+{
+	dynamics.push_back(c);
+	return dynamics.size() - 1;
+}
+
+void ColliderSet::clear()
+{
+	planes.clear();
+	statics.clear();
+	nodes.clear();
+	dynamics.clear();
+}
+
+void ColliderSet::build()
+{
+	nodes.clear();
+	if (!statics.empty())
+		buildNode(0, statics.size());
+}
+
+// Splits at the median of the longest axis of the collider centers
+int ColliderSet::buildNode(int first, int count)
+{
+	int index = nodes.size();
+	nodes.push_back(Node());
+
+	Aabb box;
+	Aabb centers;
+	for (int i = first; i < first + count; ++i)
+	{
+		Aabb b = statics[i].bounds();
+		box.expand(b);
+		centers.expand(b.center());
+	}
+
+	const int LEAF_SIZE = 4;
+	if (count <= LEAF_SIZE)
+	{
+		Node & leaf = nodes[index];
+		leaf.box = box;
+		leaf.left = leaf.right = -1;
+		leaf.first = first;
+		leaf.count = count;
+		return index;
+	}
+
+	Vector3 extent = centers.hi - centers.lo;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	int half = count / 2;
+	std::nth_element(statics.begin() + first, statics.begin() + first + half, statics.begin() + first + count,
+		[axis](const Collider & l, const Collider & r)
+		{
+			Vector3 cl = l.bounds().center();
+			Vector3 cr = r.bounds().center();
+			return axis == 0 ? cl.x < cr.x : (axis == 1 ? cl.y < cr.y : cl.z < cr.z);
+		});
+
+	int left = buildNode(first, half);
+	int right = buildNode(first + half, count - half);
+	Node & node = nodes[index];
+	node.box = box;
+	node.left = left;
+	node.right = right;
+	node.first = 0;
+	node.count = 0;
+	return index;
+}
+
+void ColliderSet::resolve(std::vector<Particle*> & particles) const
+{
+	if (particles.empty())
+		return;
+
+	// Everything only needs looking at if it is near the particles
+	Aabb bounds;
+	for (int i = 0; i < particles.size(); ++i)
+		bounds.expand(particles[i]->pos);
+
+	// A plane is skipped when the whole box is on its free side
+	const Collider * touching[MAX_PLANES];
+	int count = 0;
+	Vector3 center = bounds.center();
+	Vector3 half = bounds.hi - center;
+	for (int i = 0; i < planes.size(); ++i)
+	{
+		const Vector3 & n = planes[i].b;
+		double nearest = (center - planes[i].a).dot(n) -
+			(std::abs(n.x) * half.x + std::abs(n.y) * half.y + std::abs(n.z) * half.z);
+		if (nearest > 0.0)
+			continue;
+		touching[count++] = &planes[i];
+		if (count == MAX_PLANES)
+		{
+			collidePlanes(touching, count, particles);
+			count = 0;
+		}
+	}
+	if (count > 0)
+		collidePlanes(touching, count, particles);
+
+	if (!nodes.empty())
+	{
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node & node = nodes[stack[--top]];
+			if (!node.box.overlaps(bounds))
+				continue;
+			if (node.count > 0)
+			{
+				for (int i = node.first; i < node.first + node.count; ++i)
+					if (statics[i].bounds().overlaps(bounds))
+						collide(statics[i], particles);
+			}
+			else
+			{
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+	}
+
+	for (int i = 0; i < dynamics.size(); ++i)
+		if (dynamics[i].bounds().overlaps(bounds))
+			collide(dynamics[i], particles);
+}
+
+static ColliderSet windowColliders()
+{
+	ColliderSet set;
+	set.addStatic(Collider::plane(Vector3(0.0, 0.0, 0.0), Vector3(1.0, 0.0, 0.0)));
+	set.addStatic(Collider::plane(Vector3(WINDOW_WIDTH, 0.0, 0.0), Vector3(-1.0, 0.0, 0.0)));
+	set.addStatic(Collider::plane(Vector3(0.0, WINDOW_HEIGHT, 0.0), Vector3(0.0, -1.0, 0.0)));
+	set.addStatic(Collider::plane(Vector3(0.0, 0.0, 0.0), Vector3(0.0, 1.0, 0.0), 1.0, true));
+	return set;
+}
+
+// Built during static initialization, before any thread can ask for it
+static ColliderSet sceneColliders = windowColliders();
+
+ColliderSet & defaultColliders()
+{
+	return sceneColliders;
+}
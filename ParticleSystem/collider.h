@@ -0,0 +1,122 @@
+#ifndef __COLLIDER_H__
+#define __COLLIDER_H__
+
+#include "vector3.h"
+
+#include <vector>
+
+struct Particle;
+
+// Axis aligned bounding box, empty (lo > hi) when default constructed
+struct Aabb
+{
+	Vector3 lo;
+	Vector3 hi;
+
+	Aabb();
+	Aabb(const Vector3 & lo, const Vector3 & hi);
+
+	void expand(const Vector3 & p);
+	// Empty boxes leave this one as it is
+	void expand(const Aabb & b);
+	bool overlaps(const Aabb & b) const;
+	// Distance from p to the box, 0 when p is inside
+	double distance(const Vector3 & p) const;
+	Vector3 center() const { return (lo + hi) * 0.5; }
+	bool isEmpty() const { return lo.x > hi.x; }
+};
+
+// Shapes a Collider can have
+enum ColliderShape
+{
+	COLLIDER_PLANE,
+	COLLIDER_BOX,
+	COLLIDER_SPHERE,
+	COLLIDER_CAPSULE
+};
+
+// A solid shape particles are pushed out of. A particle touching it loses the
+// velocity going into the surface, which comes back scaled by restitution
+struct Collider
+{
+	ColliderShape shape;
+
+	// plane: a point on it and its unit normal, pointing to the free side
+	// box: the min and max corners
+	// sphere: the center in a
+	// capsule: the ends of its segment
+	Vector3 a;
+	Vector3 b;
+	double radius;
+
+	// Share of the normal speed kept by a bounce, 1 bounces back at full speed
+	double restitution;
+
+	// Particles that touch a sticky collider are locked where they are
+	bool sticky;
+
+	static Collider plane(const Vector3 & point, const Vector3 & normal,
+							double restitution = 1.0, bool sticky = false);
+	static Collider box(const Vector3 & lo, const Vector3 & hi,
+							double restitution = 1.0, bool sticky = false);
+	static Collider sphere(const Vector3 & center, double radius,
+							double restitution = 1.0, bool sticky = false);
+	static Collider capsule(const Vector3 & a, const Vector3 & b, double radius,
+							double restitution = 1.0, bool sticky = false);
+
+	// Bounds of the shape, planes are unbounded
+	Aabb bounds() const;
+};
+
+// The colliders of a scene. Static ones are kept in a bounding volume hierarchy,
+// except planes which are unbounded and kept in a list of their own, and ones
+// that move are a short list checked against the particles' bounds every time
+class ColliderSet
+{
+public:
+	ColliderSet();
+
+	// Adds colliders that never move, the hierarchy is rebuilt each call
+	// so add many at once with the second version
+	void addStatic(const Collider & c);
+	void addStatic(const std::vector<Collider> & colliders);
+
+	// Adds a collider that may be moved through dynamicCollider(), returns its index
+	int addDynamic(const Collider & c);
+	Collider & dynamicCollider(int i) { return dynamics[i]; }
+	int dynamicCount() const { return dynamics.size(); }
+
+	void clear();
+
+	// Pushes the particles out of every collider near them. Planes and the hierarchy
+	// are culled once against the bounds of all the particles, then each collider
+	// left (all the planes together) is a pass over the particles with no
+	// per-particle branching on the shape. Safe to call for several lists at once
+	void resolve(std::vector<Particle*> & particles) const;
+
+private:
+	// A node of the hierarchy, leaves have count > 0 and cover
+	// statics[first] .. statics[first + count - 1]
+	struct Node
+	{
+		Aabb box;
+		int left;
+		int right;
+		int first;
+		int count;
+	};
+
+	void build();
+	int buildNode(int first, int count);
+
+	std::vector<Collider> planes;
+	std::vector<Collider> statics;
+	std::vector<Node> nodes;
+	std::vector<Collider> dynamics;
+};
+
+// The colliders particle systems use unless told otherwise: the window edges,
+// bouncy on the sides and top and sticky on the floor where the strands grow
+ColliderSet & defaultColliders();
+
+#endif
@@ -18,4 +18,32 @@ struct Color4
 	{}
 };
 
+// A compact color, one byte per channel (0-255)
+struct ColorRGBA8
+{
+	unsigned char r;
+	unsigned char g;
+	unsigned char b;
+	unsigned char a;
+
+	ColorRGBA8()
+		: r(0), g(0), b(0), a(255)
+	{}
+	ColorRGBA8(const Color4 & c)
+		: r(toByte(c.r)), g(toByte(c.g)), b(toByte(c.b)), a(toByte(c.a))
+	{}
+
+	Color4 toColor4() const
+	{
+		return Color4(r / 255.0f, g / 255.0f, b / 255.0f, a / 255.0f);
+	}
+
+	static unsigned char toByte(float v)
+	{
+		if (v <= 0.0f) return 0;
+		if (v >= 1.0f) return 255;
+		return (unsigned char)(v * 255.0f + 0.5f);
+	}
+};
+
 #endif
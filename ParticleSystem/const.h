@@ -4,4 +4,13 @@
 const double PI = 3.14159265;
 const double EPSILON = 0.015625; //2^-6
 
+//800x800 window
+const int WINDOW_WIDTH = 800;
+const int WINDOW_HEIGHT = 800;
+
+//milliseconds per simulation step
+const int FRAME_RATE = 25;
+//the same step in seconds
+const double FRAME_DT = FRAME_RATE / 1000.0;
+
 #endif
@@ -0,0 +1,81 @@
+#ifndef __HALF_H__
+#define __HALF_H__
+
+#include <cstring>
+#include <cmath>
+
+// A 16 bit IEEE half precision float, for compact storage of values that
+// don't need more than about 3 significant digits (like particle sizes).
+// Converts to and from float, rounding to the nearest representable value
+struct Half
+{
+	unsigned short bits;
+
+	Half()
+		: bits(0)
+	{}
+	Half(float f)
+		: bits(fromFloat(f))
+	{}
+
+	operator float() const { return toFloat(bits); }
+
+	static unsigned short fromFloat(float f)
+	{
+		unsigned int x;
+		std::memcpy(&x, &f, sizeof(x));
+		unsigned int sign = (x >> 16) & 0x8000;
+		unsigned int absx = x & 0x7fffffff;
+
+		// Infinity and NaN
+		if (absx >= 0x7f800000)
+			return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+		// Too large, rounds to infinity
+		if (absx >= 0x477ff000)
+			return sign | 0x7c00;
+		// Subnormal in half precision (or too small, rounds to zero)
+		if (absx < 0x38800000)
+		{
+			if (absx < 0x33000000)
+				return sign;
+			unsigned int mant = (absx & 0x7fffff) | 0x800000;
+			int shift = 126 - (absx >> 23);
+			unsigned int h = mant >> shift;
+			unsigned int rem = mant & ((1u << shift) - 1);
+			unsigned int halfway = 1u << (shift - 1);
+			if (rem > halfway || (rem == halfway && (h & 1)))
+				++h;
+			return sign | h;
+		}
+		// Normal, rebias the exponent from 127 to 15 and round to nearest even
+		unsigned int h = (absx >> 13) - (112 << 10);
+		unsigned int rem = absx & 0x1fff;
+		if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+			++h;
+		return sign | h;
+	}
+
+	static float toFloat(unsigned short h)
+	{
+		unsigned int sign = (h & 0x8000) << 16;
+		unsigned int exp = (h >> 10) & 0x1f;
+		unsigned int mant = h & 0x3ff;
+
+		if (exp == 0)
+		{
+			float f = std::ldexp((float)mant, -24);
+			return sign ? -f : f;
+		}
+
+		unsigned int x;
+		if (exp == 31)
+			x = sign | 0x7f800000 | (mant << 13);
+		else
+			x = sign | ((exp + 112) << 23) | (mant << 13);
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+};
+
+#endif
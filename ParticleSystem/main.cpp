@@ -3,6 +3,11 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <map>
 #include <GL/glut.h>
 
 #ifdef _WIN32
@@ -28,10 +33,11 @@ void usleep(__int64 usec)
 #include "color.h"
 #include "vector3.h"
 #include "particlesystem.h"
+#include "player.h"
+#include "snapshot.h"
+#include "taskgraph.h"
+#include "telemetry.h"
 
-//800x800 window
-const int WINDOW_WIDTH = 800;
-const int WINDOW_HEIGHT = 800;
 const float VIEW_LEFT = 0.0;
 const float VIEW_RIGHT = WINDOW_WIDTH;
 const float VIEW_BOTTOM = 0.0;
@@ -41,13 +47,77 @@ const float VIEW_BACK = 800;
 
 int currentTime = 0;
 int previousTime = 0;
-const int FRAME_RATE = 25;
-const float pi = 3.14159265359;
-const float globalDrag = 0.999;
 std::vector<ParticleSystem*> psystems;
 
+//when true the simulation runs on its own thread and GLrender draws the newest
+//finished step, otherwise simulation and rendering alternate on the GLUT thread
+const bool PIPELINED = true;
+SnapshotBuffer frames;
+//when true each particle system picks its own step within these limits
+const bool ADAPTIVE_TIMESTEP = false;
+const TimestepLimits timestepLimits;
+//when true a step runs as a task graph, each system goes through collisions,
+//forces, integration and cleanup without waiting for the others at every stage
+const bool TASK_GRAPH = true;
+TaskExecutor* executor = NULL;
+TaskGraph frameGraph;
+//the balls of the step being run and the hits counted by each system's collision
+//task, one row of balls per system. Kept from frame to frame so the tasks can
+//share them without copying
+std::vector<Player*> frameBalls;
+std::vector<int> ballHits;
+//when true strands far from every ball or outside the window are simulated
+//at reduced detail (see ParticleSystemSpringMass::setDetail). A strand drops
+//to it once the nearest ball is LOD_FAR away and comes back within LOD_NEAR
+const bool LEVEL_OF_DETAIL = false;
+const double LOD_FAR = 150.0;
+const double LOD_NEAR = 100.0;
+//guards psystems and the balls against input callbacks while a step is running
+std::mutex simMutex;
+//the simulation thread in pipelined mode, it runs until stopSimulation is set
+std::thread simulationThread;
+std::atomic<bool> stopSimulation(false);
+int frameCount = 0;
+//when true every step's timings and counts go to shared memory, where the
+//Telemetry tool reads them
+const bool TELEMETRY = true;
+TelemetryWriter telemetry;
+//stats of the step in progress, GLthrottle publishes them once it knows the overrun
+FrameStats frameStats;
+//nanoseconds spent in each phase of the step, added to by every task thread
+std::atomic<long long> phaseNanos[PHASE_COUNT];
+long long lastAllocations = 0;
+typedef std::chrono::steady_clock Clock;
+//when true GLrender draws each chunk of a frame (see ChunkSnapshot) from a display
+//list that is only rebuilt when the chunk's version changes, so resting strands
+//aren't sent to the GPU again every frame. A reused list can be up to twice the
+//systems' motionThreshold behind the simulation
+const bool DIRTY_RENDER = true;
+//display list of a chunk, the version it was built from and the last render that drew it
+struct ChunkList
+{
+    GLuint list;
+    unsigned version;
+    int render;
+};
+//only touched by the GLUT thread, which owns the GL context
+std::map<std::pair<unsigned, int>, ChunkList> chunkLists;
+int renderCount = 0;
+
 void GLrender();
 void GLupdate();
+void GLthrottle();
+void stepSimulation();
+void runFrameGraph();
+void updateDetail();
+void simulationLoop();
+void shutdownSimulation();
+void publishFrame();
+void renderFrame(const FrameSnapshot & frame);
+void renderChunks(const FrameSnapshot & frame);
+void renderParticles(const FrameSnapshot & frame, int first, int count);
+void renderSprings(const FrameSnapshot & frame, int first, int count);
+int elapsedTime();
 void setupScene();
 void GLprocessMouse(int button, int state, int x, int y);
 void DrawCircle(float cx, float cy, float r, int num_segments) ;
@@ -57,133 +127,11 @@ double randDouble(double min, double max)
 	return rand() / static_cast<double>(RAND_MAX) * (max - min) + min;
 }
 
-//controls ball
-class Player
-{
-public:
-    float r, m;
-    bool rotate, isPlayer;
-    Vector3 pos, vel, acc;
-    Color4 col;
-    
-    void update()
-    {
-    	if(pos.x + r >= WINDOW_WIDTH || pos.x - r <= 0.0)
-     	   vel.x *= -1;
-
-    	if(pos.y + r >= WINDOW_HEIGHT || pos.y - r <= 0.0)
-     	   vel.y *= -1;
-     	
-     	//velocity of ball is affected by the global drag force
-    	vel *= globalDrag;
-    	pos += vel * (FRAME_RATE / 1000.0);
-	}
-	Player()
-	{
-	    pos = Vector3(WINDOW_WIDTH / 2.0, WINDOW_HEIGHT / 2.0, 0.0);
-        vel = Vector3(0.0, 0.0, 0.0);
-        acc = Vector3(0.0, 0.0, 0.0);
-	    r = 40.0;
-	    m = 40.0;
-	    rotate = false;
-	    isPlayer = false;
-	    col = Color4(1.0, 0.0, 0.0, 1.0);
-	}
-	Player(Vector3 center, float size, float mass)
-	{
-	    pos = center;
-        vel = Vector3(0.0, 0.0, 0.0);
-        acc = Vector3(0.0, 0.0, 0.0);
-	    r = size;
-	    m = mass;
-	    rotate = false;
-	    isPlayer = false;
-	    col = Color4(1.0, 0.0, 0.0, 1.0);
-	}
-	void render()
-	{
-	    glPushMatrix();
-        glColor3f(col.r, col.g, col.b);
-        
-        //controls rotation of ball
-        if(rotate)
-        {
-            float rot_x = sin(currentTime/4.0 * (FRAME_RATE / 1000.0)) * 300.0;
-            float rot_y = cos(currentTime/4.0 * (FRAME_RATE / 1000.0)) * 300.0;  
-          
-            //sets velocity of ball as rotation 
-            vel = Vector3(rot_x, rot_y, 0.0);
-        }
-        glTranslatef(pos.x, pos.y, pos.z);
-        glutSolidSphere(this->r, 80.0, 80.0);
-        glPopMatrix();
-    }
-    float volume()
-    {
-        return (4.0/3.0) * pi * r*r*r;
-    }
-    float perimeter()
-    {
-        return 2.0 * pi * r;
-    }
-    float area()
-    {
-        return 4.0 * pi * r;
-    }
-    bool isInside(const Vector3& p) const
-    {
-        Vector3 temp = this->pos - p;
-        double distance = temp.x*temp.x + temp.y*temp.y + temp.z*temp.z;
-        if(distance <= r*r)
-            return true;
-        return false;
-    }
-    bool lineCollision(const Vector3& p1, const Vector3& p2) const
-    {
-        //distance direction vector
-        Vector3 d = p2 - p1;
-        
-        //vector from first point of line to center of sphere
-        Vector3 f = p1 - pos;
-        
-        //calculate using pythagorean formula
-        float a = d.dot(d);
-        float b = 2.0 * f.dot(d);
-        float c = f.dot(f) - r*r;
-        
-        float check = (b * b) - (4.0 * a * c);
-        
-        //no collision
-        if(check < 0.0)
-            return false;
-        
-        //there may be a collision
-        else
-        {
-            //apply pythagorean formula
-            check = sqrt(check);
-            float t1 = (-1.0 * b - check) / (2.0 * a);
-            float t2 = (-1.0 * b + check) / (2.0 * a);
-            
-            //check if point is within sphere
-            if(t1 >= 0.0 && t1 <= 1.0)
-                return true;
-            if(t2 >= 0.0 && t2 <= 1.0)
-                return true;
-            return false;
-        }
-        
-        return false;
-    }
-    void rotation(bool trigger)
-    {
-        rotate = trigger;
-    }
-};
 std::vector<Player*> fish;
 Player p1;
 void Keyboard(unsigned char key, int x, int y);
-void GLCollisions(Player& ball);
+int GLCollisions(Player& ball);
+int collideSystem(ParticleSystemSpringMass* a, const Player& ball, Vector3& ballVel);
 void GLrunItAll();
 
 //Initializes OpenGL attributes
@@ -213,11 +161,13 @@ int main(int argc, char** argv)
 {
     p1 = Player(Vector3(WINDOW_WIDTH / 2.0, WINDOW_HEIGHT / 2.0, 0.0), 40.0, 20.0);
     p1.isPlayer = true;
+    std::vector<ParticleSystemSpringMass::SpawnParams> weeds;
     for(int i = 0; i < 6; ++i)
     {
         Vector3 weed_origin(((i+1)*100.0), 0.0, 0.0);
-        psystems.push_back(new ParticleSystemSpringMass(weed_origin));
+        weeds.push_back(ParticleSystemSpringMass::SpawnParams(weed_origin));
     }
+    ParticleSystemSpringMass::spawn(weeds, psystems);
 
 	srand(time(NULL));
 	
@@ -236,58 +186,389 @@ int main(int argc, char** argv)
     
 	GLInit(&argc, argv);
 	glutKeyboardFunc(Keyboard);
+
+    if(TASK_GRAPH)
+        executor = new TaskExecutor();
+    if(TELEMETRY)
+        telemetry.open();
+
+    //the first frame is published before any thread can render
+    publishFrame();
+    if(PIPELINED)
+        simulationThread = std::thread(simulationLoop);
+    //GLUT leaves through exit() when the window closes. Handlers registered now
+    //run before the globals the simulation thread uses are destroyed
+    atexit(shutdownSimulation);
 	glutMainLoop();
 }
 
 void GLrunItAll()
 {
-    GLCollisions(p1);
-    for(int i = 0; i < fish.size(); ++i)
-        GLCollisions(*fish[i]);
-    GLupdate();
+    if(PIPELINED)
+    {
+        //only redraw when the simulation thread has finished a new step
+        if(frames.hasNewFrame())
+            glutPostRedisplay();
+        else
+            usleep(1000);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(simMutex);
+        stepSimulation();
+    }
     glutPostRedisplay();
+    GLthrottle();
+}
+
+//runs work and adds the time it took to phase
+template <class Work>
+void timePhase(TelemetryPhase phase, const Work & work)
+{
+    Clock::time_point start = Clock::now();
+    work();
+    phaseNanos[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+//adds a task to frameGraph that is timed as part of phase
+template <class Work>
+TaskGraph::Task addTimedTask(TelemetryPhase phase, const Work & work)
+{
+    return frameGraph.add([phase, work]() { timePhase(phase, work); });
+}
+
+//runs one full step: collisions, update, cleanup and the balls, then hands
+//the result to the renderer
+void stepSimulation()
+{
+    Clock::time_point start = Clock::now();
+    for(int i = 0; i < PHASE_COUNT; ++i)
+        phaseNanos[i] = 0;
+
+    if(LEVEL_OF_DETAIL)
+        updateDetail();
+    if(TASK_GRAPH)
+        runFrameGraph();
+    else
+    {
+        timePhase(PHASE_COLLIDE, []()
+        {
+            frameStats.collisionHits = GLCollisions(p1);
+            for(int i = 0; i < fish.size(); ++i)
+                frameStats.collisionHits += GLCollisions(*fish[i]);
+        });
+        GLupdate();
+    }
+    timePhase(PHASE_PUBLISH, publishFrame);
+
+    frameStats.stepMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    for(int i = 0; i < PHASE_COUNT; ++i)
+        frameStats.phaseMs[i] = phaseNanos[i] / 1e6;
+}
+
+//picks each strand's detail from the gap to the nearest ball, with some
+//hysteresis so a ball at the edge doesn't flip it every frame
+void updateDetail()
+{
+    std::vector<Player*> balls(fish);
+    balls.push_back(&p1);
+    Aabb view(Vector3(VIEW_LEFT, VIEW_BOTTOM, VIEW_FRONT), Vector3(VIEW_RIGHT, VIEW_TOP, VIEW_BACK));
+
+    for(int i = 0; i < psystems.size(); ++i)
+    {
+        ParticleSystemSpringMass* ps = dynamic_cast<ParticleSystemSpringMass*>(psystems[i]);
+        if(ps == NULL)
+            continue;
+        Aabb box = ps->bounds();
+        double gap = LOD_FAR + 1.0;
+        for(int b = 0; b < balls.size(); ++b)
+            gap = std::min(gap, box.distance(balls[b]->pos) - balls[b]->r);
+
+        if(!box.overlaps(view) || gap > LOD_FAR)
+            ps->setDetail(ParticleSystemSpringMass::DETAIL_REDUCED);
+        else if(gap < LOD_NEAR)
+            ps->setDetail(ParticleSystemSpringMass::DETAIL_FULL);
+    }
+}
+
+//the same step as a task graph: per system collide -> forces -> bounds -> integrate -> cleanup.
+//The balls move once every system has collided with them and finished systems
+//are dropped once every cleanup is done, nothing else waits on all the systems
+void runFrameGraph()
+{
+    std::vector<Player*>& balls = frameBalls;
+    balls.clear();
+    balls.push_back(&p1);
+    balls.insert(balls.end(), fish.begin(), fish.end());
+    const int numBalls = balls.size();
+    const int numSystems = psystems.size();
+    const double dt = FRAME_DT;
+
+    double ballSpeed = 0.0;
+    for(int i = 0; i < numBalls; ++i)
+        ballSpeed = std::max(ballSpeed, balls[i]->vel.magnitude());
+
+    //systems only read the balls while colliding, the balls are slowed by
+    //all the hits together afterwards
+    ballHits.assign(numSystems * numBalls, 0);
+
+    frameGraph.clear();
+    TaskGraph::Task moveBalls = addTimedTask(PHASE_BALLS, [numSystems]()
+    {
+        for(int b = 0; b < frameBalls.size(); ++b)
+        {
+            int hits = 0;
+            for(int i = 0; i < numSystems; ++i)
+                hits += ballHits[i * frameBalls.size() + b];
+            frameBalls[b]->vel *= std::pow(0.9999, hits);
+            frameBalls[b]->update(currentTime);
+        }
+    });
+    TaskGraph::Task removeDone = addTimedTask(PHASE_CLEANUP, []() { removeDoneParticleSystems(psystems); });
+
+    for(int i = 0; i < numSystems; ++i)
+    {
+        ParticleSystemSpringMass* ps = dynamic_cast<ParticleSystemSpringMass*>(psystems[i]);
+        int* hits = &ballHits[i * numBalls];
+
+        TaskGraph::Task collide = addTimedTask(PHASE_COLLIDE, [ps, hits]()
+        {
+            for(int b = 0; b < frameBalls.size(); ++b)
+            {
+                Vector3 vel = frameBalls[b]->vel;
+                hits[b] = collideSystem(ps, *frameBalls[b], vel);
+            }
+        });
+        TaskGraph::Task cleanup = addTimedTask(PHASE_CLEANUP, [ps]() { ps->cleanup(); });
+
+        if(ADAPTIVE_TIMESTEP)
+        {
+            //substeps alternate forces and integration, so they stay one task
+            TaskGraph::Task step = addTimedTask(PHASE_STEP, [ps, dt, ballSpeed]() { stepParticleSystem(ps, dt, timestepLimits, ballSpeed); });
+            frameGraph.precede(collide, step);
+            frameGraph.precede(step, cleanup);
+        }
+        else
+        {
+            TaskGraph::Task forces = addTimedTask(PHASE_STEP, [ps, dt]() { ps->applyForces(dt); });
+            TaskGraph::Task bounds = addTimedTask(PHASE_STEP, [ps]() { ps->resolveCollisions(); });
+            TaskGraph::Task integrate = addTimedTask(PHASE_STEP, [ps, dt]() { ps->integrate(dt); });
+            frameGraph.precede(collide, forces);
+            frameGraph.precede(forces, bounds);
+            frameGraph.precede(bounds, integrate);
+            frameGraph.precede(integrate, cleanup);
+        }
+        frameGraph.precede(collide, moveBalls);
+        frameGraph.precede(cleanup, removeDone);
+    }
+
+    executor->run(frameGraph);
+
+    frameStats.collisionHits = 0;
+    for(int i = 0; i < ballHits.size(); ++i)
+        frameStats.collisionHits += ballHits[i];
+}
+
+//body of the simulation thread in pipelined mode
+void simulationLoop()
+{
+    while(!stopSimulation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(simMutex);
+            stepSimulation();
+        }
+        GLthrottle();
+    }
+}
+
+//stops the simulation thread and waits for the step it is in to finish, then
+//closes the telemetry it was publishing to
+void shutdownSimulation()
+{
+    stopSimulation = true;
+    if(simulationThread.joinable())
+        simulationThread.join();
+    telemetry.close();
 }
 
 void GLupdate()
 {
-	double dt = FRAME_RATE / 1000.0;
-	updateParticleSystems(psystems, dt);
-	cleanupParticleSystems(psystems);
-
-	glutPostRedisplay();
-    p1.update();
-    for(int i = 0; i < fish.size(); ++i)
-        fish[i]->update();
-        
+	double dt = FRAME_DT;
+	if(ADAPTIVE_TIMESTEP)
+	{
+	    double ballSpeed = p1.vel.magnitude();
+	    for(int i = 0; i < fish.size(); ++i)
+	        ballSpeed = std::max(ballSpeed, fish[i]->vel.magnitude());
+	    timePhase(PHASE_STEP, [dt, ballSpeed]() { updateParticleSystems(psystems, dt, timestepLimits, ballSpeed); });
+	}
+	else
+	    timePhase(PHASE_STEP, [dt]() { updateParticleSystems(psystems, dt); });
+	timePhase(PHASE_CLEANUP, []() { cleanupParticleSystems(psystems); });
+
+    timePhase(PHASE_BALLS, []()
+    {
+        p1.update(currentTime);
+        for(int i = 0; i < fish.size(); ++i)
+            fish[i]->update(currentTime);
+    });
+}
+
+void GLthrottle()
+{
 	//sleep is not effective in capturing constant time between frames because sleep
 	//doesn't consider the time it takes for context-switching. However, this reduces
 	//the cpu-usage. If accurate time frames are desire, use a time accumulator
-	currentTime = glutGet(GLUT_ELAPSED_TIME);
+	currentTime = elapsedTime();
 	int diffTime = currentTime - previousTime;
 	previousTime = currentTime;
+
+	//the step that just finished is reported with how late its frame was
+	frameStats.overrunMs = std::max(diffTime - FRAME_RATE, 0);
+	long long allocations = allocationCount();
+	frameStats.allocations = allocations < 0 ? -1 : allocations - lastAllocations;
+	lastAllocations = allocations;
+	telemetry.publish(frameStats);
+
 	usleep(1000 * std::max(FRAME_RATE - diffTime, 0));
 }
 
+//milliseconds since the program started, safe to call from any thread
+//(unlike glutGet(GLUT_ELAPSED_TIME))
+int elapsedTime()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//copies the particle systems and balls into the back buffer and swaps it in
+void publishFrame()
+{
+    FrameSnapshot& frame = frames.backBuffer();
+    snapshotParticleSystems(psystems, frame);
+
+    std::vector<Player*> balls(fish);
+    balls.push_back(&p1);
+    for(int i = 0; i < balls.size(); ++i)
+    {
+        BallSnapshot b;
+        b.pos = balls[i]->pos;
+        b.r = balls[i]->r;
+        b.col = balls[i]->col;
+        frame.balls.push_back(b);
+    }
+    frame.frame = frameCount++;
+    frames.publish();
+
+    //each snapshot carries the motion since the one before
+    for(int i = 0; i < psystems.size(); ++i)
+        psystems[i]->clearDirty();
+
+    frameStats.frame = frame.frame;
+    frameStats.systems = psystems.size();
+    frameStats.particles = frame.particles.size();
+    frameStats.springs = frame.springs.size();
+}
+
 void GLrender()
 {
 	glClear(GL_COLOR_BUFFER_BIT); 
-	for (int i = 0; i < psystems.size(); ++i)
-	{
-		psystems[i]->render();
-    }
-    for(int i = 0; i < fish.size(); ++i)
-        fish[i]->render();
-        
-    p1.render();
-        
+	renderFrame(frames.acquire());
 	glFlush();	
 	glutSwapBuffers();
 }
 
+//draws a snapshot, this never touches the live particle systems
+void renderFrame(const FrameSnapshot & frame)
+{
+    if(DIRTY_RENDER)
+        renderChunks(frame);
+    else
+    {
+        renderParticles(frame, 0, frame.particles.size());
+        renderSprings(frame, 0, frame.springs.size());
+    }
+
+    for(int i = 0; i < frame.balls.size(); ++i)
+    {
+        const BallSnapshot& b = frame.balls[i];
+        glPushMatrix();
+        glColor3f(b.col.r, b.col.g, b.col.b);
+        glTranslatef(b.pos.x, b.pos.y, b.pos.z);
+        glutSolidSphere(b.r, 80.0, 80.0);
+        glPopMatrix();
+    }
+}
+
+//draws every chunk from its display list, rebuilding the lists of new and changed
+//chunks. The renderer may skip frames, versions still tell what changed since
+void renderChunks(const FrameSnapshot & frame)
+{
+    ++renderCount;
+    for(int i = 0; i < frame.chunks.size(); ++i)
+    {
+        const ChunkSnapshot& c = frame.chunks[i];
+        ChunkList& cached = chunkLists[std::make_pair(c.system, c.chunk)];
+        if(cached.list == 0 || cached.version != c.version)
+        {
+            if(cached.list == 0)
+                cached.list = glGenLists(1);
+            glNewList(cached.list, GL_COMPILE_AND_EXECUTE);
+            renderParticles(frame, c.firstParticle, c.particleCount);
+            renderSprings(frame, c.firstSpring, c.springCount);
+            glEndList();
+            cached.version = c.version;
+        }
+        else
+            glCallList(cached.list);
+        cached.render = renderCount;
+    }
+
+    //chunks that weren't in this frame belonged to removed systems or particles
+    for(std::map<std::pair<unsigned, int>, ChunkList>::iterator it = chunkLists.begin(); it != chunkLists.end(); )
+    {
+        if(it->second.render != renderCount)
+        {
+            glDeleteLists(it->second.list, 1);
+            chunkLists.erase(it++);
+        }
+        else
+            ++it;
+    }
+}
+
+void renderParticles(const FrameSnapshot & frame, int first, int count)
+{
+    for(int i = first; i < first + count; ++i)
+    {
+        const ParticleSnapshot& p = frame.particles[i];
+        glColor4ub(p.look.col.r, p.look.col.g, p.look.col.b, p.look.col.a);
+        glPointSize(p.look.size);
+        glBegin(GL_POINTS);
+        glVertex3d(p.pos.x, p.pos.y, p.pos.z);
+        glEnd();
+    }
+}
+
+void renderSprings(const FrameSnapshot & frame, int first, int count)
+{
+    glBegin(GL_LINES);
+    for(int i = first; i < first + count; ++i)
+    {
+        const Vector3& a = frame.particles[frame.springs[i].particle1].pos;
+        const Vector3& b = frame.particles[frame.springs[i].particle2].pos;
+        glVertex3f(a.x, a.y, a.z);
+        glVertex3f(b.x, b.y, b.z);
+    }
+    glEnd();
+}
+
 void GLprocessMouse(int button, int state, int x, int y)
 {
 	if (state == GLUT_DOWN)
 	{
+		std::lock_guard<std::mutex> lock(simMutex);
 		psystems.push_back(new ParticleSystemSpringMass(Vector3(x, WINDOW_HEIGHT - y, 0)));
 	}
 } 
@@ -295,6 +576,7 @@ void GLprocessMouse(int button, int state, int x, int y)
 //controls ball by incrementing velocity
 void Keyboard(unsigned char key, int x, int y)
 {
+    std::lock_guard<std::mutex> lock(simMutex);
     if(key == 'w')
     { 
         p1.rotation(0);
@@ -326,43 +608,57 @@ void Keyboard(unsigned char key, int x, int y)
     }
 }
 
-void GLCollisions(Player& ball)
+//collides the ball with every system and returns the number of hits
+int GLCollisions(Player& ball)
 {
-    double dt = FRAME_RATE / 1000.0;
-
+    int hits = 0;
 	for(int i = 0; i < psystems.size(); ++i)
 	{
 	    ParticleSystemSpringMass* a = dynamic_cast<ParticleSystemSpringMass*>(psystems[i]);
+	    hits += collideSystem(a, ball, ball.vel);
+	}
+    return hits;
+}
+
+//collides one system with a ball moving at ballVel, which is slowed by every
+//hit, and returns the number of hits
+int collideSystem(ParticleSystemSpringMass* a, const Player& ball, Vector3& ballVel)
+{
+    double dt = FRAME_DT;
+    int hits = 0;
+
+    //applys force to each spring
+	for(int j = 0; j < a->springConnections.size(); ++j)
+	{
+	    Particle* p1 = a->springConnections[j].particle1;
+	    Particle* p2 = a->springConnections[j].particle2;
+	    ExternalForces& f1 = a->externalForces[a->springConnections[j].index1];
+	    ExternalForces& f2 = a->externalForces[a->springConnections[j].index2];
 	    
-	    //applys force to each spring
-		for(int j = 0; j < a->springConnections.size(); ++j)
-		{
-		    Particle* p1 = a->springConnections[j].particle1;
-		    Particle* p2 = a->springConnections[j].particle2;
-		    
-		    //oscillates enviroment force applied to seaweed
-		    if(ball.isPlayer)
-		    {
-		        int dir = 1;
-		        if((int)currentTime % 2 == 0)
-		            dir = -1;
-		        p1->enviromentForce = Vector3(((int)currentTime % 4000) * dir * dt, 0.0, 0.0);
-		        p2->enviromentForce = Vector3(((int)currentTime % 4000) * dir * dt, 0.0, 0.0);
-		    }
-		    //applys ball force to weeds if ball collides
-		    if(ball.lineCollision(p1->pos, p2->pos))
-		    {
-    			p1->ballForce.push_back(ball.vel * ball.m * dt);
-    			p2->ballForce.push_back(ball.vel * ball.m * dt);
-    			ball.vel *= 0.9999;
-    	    }
-    	   //else
-    	    //{
-    			//p1->ballForce.push_back(Vector3());
-    			//p2->ballForce.push_back(Vector3());
-    	    //}
-		}
+	    //oscillates enviroment force applied to seaweed
+	    if(ball.isPlayer)
+	    {
+	        int dir = 1;
+	        if((int)currentTime % 2 == 0)
+	            dir = -1;
+	        f1.enviromentForce = Vector3(((int)currentTime % 4000) * dir * dt, 0.0, 0.0);
+	        f2.enviromentForce = Vector3(((int)currentTime % 4000) * dir * dt, 0.0, 0.0);
+	    }
+	    //applys ball force to weeds if ball collides
+	    if(ball.lineCollision(p1->pos, p2->pos))
+	    {
+			f1.ballForce += ballVel * ball.m * dt;
+			f2.ballForce += ballVel * ball.m * dt;
+			ballVel *= 0.9999;
+			++hits;
+	    }
+	   //else
+	    //{
+			//f1.ballForce += Vector3();
+			//f2.ballForce += Vector3();
+	    //}
 	}
+    return hits;
 }
 
 void setupScene()
@@ -0,0 +1,23 @@
+#ifndef __PARTICLELOOK_H__
+#define __PARTICLELOOK_H__
+
+#include "color.h"
+#include "half.h"
+
+// Render attributes of a particle packed into 6 bytes: an RGBA8 color and a
+// half precision point size. Kept out of Particle so the simulation loops
+// don't drag them through the cache
+struct ParticleLook
+{
+	ColorRGBA8 col;
+	Half size;
+
+	ParticleLook()
+		: col(), size(1.0f)
+	{}
+	ParticleLook(const Color4 & c, double sz)
+		: col(c), size((float)sz)
+	{}
+};
+
+#endif
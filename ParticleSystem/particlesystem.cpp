@@ -4,11 +4,12 @@
 #include <cmath>
 #include <cstdlib>
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
 #include "const.h"
 
-const int WINDOW_WIDTH = 800;
-const int WINDOW_HEIGHT = 800;
-
 
 /////////////////////////////////////
 /// Particle Class Implementation ///
@@ -17,109 +18,265 @@ const int WINDOW_HEIGHT = 800;
 Particle::Particle(const Vector3 & p, 
 						const Vector3 & v, 
 						const Vector3 & a, double m, 
-						double t, double sz, const Color4 & c)
-	: pos(p), vel(v), acc(a), mass(m), timer(t), size(sz), col(c), isLocked(false)
+						double t)
+	: pos(p), vel(v), acc(a), mass(m), timer(t), isLocked(false)
 {
 }
 
-void Particle::applyForce(const Vector3 & force)
+// Bounces off the window edges are done beforehand by the ColliderSet,
+// this is only the integration
+void Particle::update(double dt)
 {
-	acc += (force / mass);
+	if (timer > 0.0) timer -= dt;
+	double step = isLocked ? 0.0 : dt;
+	vel.addScaled(acc, step);
+	pos.addScaled(vel, step);
 }
 
-void Particle::applyForces(const std::vector<Vector3> & forces)
+void Particle::render(const ParticleLook & look) const
 {
-	Vector3 accumulator = Vector3();
-	for (int i = 0; i < forces.size(); ++i)
-		accumulator += forces[i];
-	acc += (accumulator / mass);
+	glColor4ub(look.col.r, look.col.g, look.col.b, look.col.a);
+	glPointSize(look.size);
+	glBegin(GL_POINTS);
+	glVertex3d(pos.x, pos.y, pos.z);
+	glEnd();
 }
 
-void Particle::update(double dt)
+TimestepLimits::TimestepLimits(double minDt, double maxDt, double courant, double maxTravel)
+	: minDt(minDt), maxDt(maxDt), courant(courant), maxTravel(maxTravel)
 {
+}
 
-    if(pos.x >= WINDOW_WIDTH)
-    {   
-        pos.x = WINDOW_WIDTH;
-        vel.x *= -1.0;
-    }
-    if(pos.x <= 0.0) 
-    {
-        pos.x = 0.0;
-        vel.x *= -1.0;
-    }
-    if(pos.y >= WINDOW_HEIGHT)
-    {
-        pos.y = WINDOW_HEIGHT;
-        vel.y *= -1.0;
-    }
-    if(pos.y <= 0.0)
-    {
-        pos.y = 0.0;    
-        vel.y *= -1.0;
-        this->isLocked = true;
-    }
-    
-	if (timer > 0.0) timer -= dt;
-	if(!isLocked)
-	{
-		vel += acc * dt;
-		pos += vel * dt;
-	}
+ParticleBlock::ParticleBlock(size_t count)
+	: begin(static_cast<Particle*>(::operator new(count * sizeof(Particle)))), end(begin + count)
+{
 }
 
-void Particle::render() const
+// Particle has nothing to destruct, so the memory can just be released
+ParticleBlock::~ParticleBlock()
 {
-	glColor4d(col.r, col.g, col.b, col.a);
-	glPointSize(size);
-	glBegin(GL_POINTS);
-	glVertex3d(pos.x, pos.y, pos.z);
-	glEnd();
+	::operator delete(begin);
 }
 
 /////////////////////////////////
 /// Base Class Implementation ///
 /////////////////////////////////
 
+// Rounding allowed between a particle's timer and the clock when expiring it
+static const double EXPIRY_SLACK = 1e-9;
+
+// Systems may be built on several threads at once (see spawn)
+static std::atomic<unsigned> nextSystemId(1);
+
 ParticleSystem::ParticleSystem(const Vector3 & startingLocation)
-	: location(startingLocation), particles()
+	: location(startingLocation), particles(), looks(), externalForces(), pendingTime(0.0), forceDt(0.0), colliders(&defaultColliders()),
+	  motionThreshold(0.01), block(), clock(0.0), handleSlots(), freeSlots(), particleSlots(), expiries(),
+	  systemId(nextSystemId++), countedPos(), countedMoved(), chunkRegions(), chunkVersions(), motionStamp(0)
 {
 }
 
 ParticleSystem::~ParticleSystem()
 {
 	for (int i = 0; i < particles.size(); ++i)
-		delete particles[i];
+		destroyParticle(particles[i]);
+}
+
+void ParticleSystem::destroyParticle(Particle* p)
+{
+	if (block && block->contains(p))
+		return;
+	delete p;
+}
+
+void ParticleSystem::applyForces(double /*dt*/)
+{
+}
+
+void ParticleSystem::integrate(double dt)
+{
+	advance(dt, true);
+}
+
+void ParticleSystem::resolveCollisions()
+{
+	if (colliders != NULL)
+		colliders->resolve(particles);
 }
 
 void ParticleSystem::update(double dt)
 {
-	for (int i = 0; i < particles.size(); ++i)
-		particles[i]->update(dt);
+	applyForces(dt);
+	resolveCollisions();
+	integrate(dt);
 }
 
 void ParticleSystem::render() const
 {
 	for (int i = 0; i < particles.size(); ++i)
-		particles[i]->render();
+		particles[i]->render(look(i));
 }
 
 void ParticleSystem::cleanup()
 {
-	std::vector<Particle*> remaining(particles.size());
-	int nsize = 0;
-	for (int i = 0; i < particles.size(); ++i)
+	trackNewParticles();
+
+	// Every timer counts down with the clock, so a particle is due at the
+	// clock time its timer was last read plus that timer. The small slack
+	// covers rounding between the two, the timer itself has the final say.
+	// A timer left within the slack counts as run out, otherwise its entry
+	// would come straight back up and be popped again for ever
+	while (!expiries.empty() && expiries.top().time <= clock + EXPIRY_SLACK)
 	{
-		if (particles[i]->timer > 0.0)
+		Expiry e = expiries.top();
+		expiries.pop();
+		const HandleSlot & slot = handleSlots[e.slot];
+		if (slot.generation != e.generation)
+			continue;
+
+		Particle* p = particles[slot.index];
+		if (p->timer > EXPIRY_SLACK)
+			expiries.push(Expiry(clock + p->timer, e.slot, e.generation));
+		else
+			removeParticle(slot.index);
+	}
+}
+
+ParticleHandle ParticleSystem::addParticle(Particle* p)
+{
+	particles.push_back(p);
+	trackNewParticles();
+	return handle(particles.size() - 1);
+}
+
+void ParticleSystem::trackNewParticles()
+{
+	fitChunks();
+	for (int i = particleSlots.size(); i < particles.size(); ++i)
+	{
+		int slot;
+		if (freeSlots.empty())
 		{
-			remaining[nsize] = particles[i];
-			++nsize;
+			slot = handleSlots.size();
+			HandleSlot s;
+			s.generation = 0;
+			handleSlots.push_back(s);
 		}
 		else
-			delete particles[i];
+		{
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		handleSlots[slot].index = i;
+		particleSlots.push_back(slot);
+		expiries.push(Expiry(clock + std::max(particles[i]->timer, 0.0), slot, handleSlots[slot].generation));
+	}
+}
+
+void ParticleSystem::removeParticle(int i)
+{
+	trackNewParticles();
+	int slot = particleSlots[i];
+	int last = particles.size() - 1;
+
+	destroyParticle(particles[i]);
+	if (i != last)
+	{
+		particles[i] = particles[last];
+		particleSlots[i] = particleSlots[last];
+		handleSlots[particleSlots[i]].index = i;
+		// Per-particle looks and forces move along with the particles
+		if (looks.size() > 1)
+			looks[i] = looks[last];
+		externalForces[i] = externalForces[last];
+	}
+	particles.pop_back();
+	particleSlots.pop_back();
+	if (looks.size() > 1)
+		looks.pop_back();
+
+	handleSlots[slot].index = -1;
+	++handleSlots[slot].generation;
+	freeSlots.push_back(slot);
+
+	// Particle i is now a different one, and the last chunk is one shorter
+	if (i != last)
+	{
+		countedPos[i] = countedPos[last];
+		countedMoved[i] = countedMoved[last];
+		markChunk(i / DIRTY_CHUNK_SIZE);
 	}
-	remaining.resize(nsize);
-	particles = remaining;
+	markChunk(last / DIRTY_CHUNK_SIZE);
+}
+
+ParticleHandle ParticleSystem::handle(int i)
+{
+	trackNewParticles();
+	int slot = particleSlots[i];
+	return ParticleHandle(slot, handleSlots[slot].generation);
+}
+
+int ParticleSystem::indexOf(const ParticleHandle & h) const
+{
+	if (h.slot < 0 || h.slot >= handleSlots.size() || handleSlots[h.slot].generation != h.generation)
+		return -1;
+	return handleSlots[h.slot].index;
+}
+
+Particle* ParticleSystem::find(const ParticleHandle & h) const
+{
+	int i = indexOf(h);
+	return i < 0 ? NULL : particles[i];
+}
+
+void ParticleSystem::retime(int i)
+{
+	trackNewParticles();
+	int slot = particleSlots[i];
+	expiries.push(Expiry(clock + std::max(particles[i]->timer, 0.0), slot, handleSlots[slot].generation));
+}
+
+void ParticleSystem::snapshot(FrameSnapshot & frame)
+{
+	// Particles pushed straight onto the list since the last step get chunks first
+	fitChunks();
+
+	const int base = frame.particles.size();
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		ParticleSnapshot ps;
+		ps.pos = particles[i]->pos;
+		ps.look = look(i);
+		frame.particles.push_back(ps);
+	}
+
+	for (int c = 0; c < chunkRegions.size(); ++c)
+	{
+		ChunkSnapshot cs;
+		cs.system = systemId;
+		cs.chunk = c;
+		cs.version = chunkVersions[c];
+		cs.dirty = chunkRegions[c];
+		cs.firstParticle = base + c * DIRTY_CHUNK_SIZE;
+		cs.particleCount = std::min(DIRTY_CHUNK_SIZE, (int)particles.size() - c * DIRTY_CHUNK_SIZE);
+		cs.firstSpring = frame.springs.size();
+		cs.springCount = 0;
+		frame.chunks.push_back(cs);
+	}
+}
+
+double ParticleSystem::stableTimestep(const TimestepLimits & limits, double ballSpeed) const
+{
+	// CFL bound: nothing moves more than maxTravel relative to the particles in one step
+	double maxSpeedSq = 0.0;
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		if (!particles[i]->isLocked)
+			maxSpeedSq = std::max(maxSpeedSq, particles[i]->vel.dot(particles[i]->vel));
+	}
+	double speed = std::sqrt(maxSpeedSq) + ballSpeed;
+	if (speed <= 0.0)
+		return limits.maxDt;
+	return limits.courant * limits.maxTravel / speed;
 }
 
 bool ParticleSystem::isDone() const
@@ -127,31 +284,218 @@ bool ParticleSystem::isDone() const
 	return particles.size() <= 0;
 }
 
+Aabb ParticleSystem::bounds() const
+{
+	Aabb box;
+	for (int i = 0; i < particles.size(); ++i)
+		box.expand(particles[i]->pos);
+	return box;
+}
+
+DirtyRegion ParticleSystem::dirty() const
+{
+	DirtyRegion region;
+	for (int c = 0; c < chunkRegions.size(); ++c)
+		region.expand(chunkRegions[c]);
+	return region;
+}
+
+void ParticleSystem::clearDirty()
+{
+	for (int c = 0; c < chunkRegions.size(); ++c)
+	{
+		if (chunkRegions[c].isClean())
+			continue;
+		for (int i = c * DIRTY_CHUNK_SIZE; i < chunkEnd(c); ++i)
+			countedMoved[i] = 0;
+		chunkRegions[c] = DirtyRegion();
+	}
+}
+
+void ParticleSystem::beginMotion()
+{
+	fitChunks();
+	++motionStamp;
+}
+
+int ParticleSystem::chunkEnd(int c) const
+{
+	return std::min((c + 1) * DIRTY_CHUNK_SIZE, (int)particles.size());
+}
+
+void ParticleSystem::trackMotion(int c)
+{
+	// The box is kept in locals for the chunk and only written back if something moved
+	const double threshold = motionThreshold * motionThreshold;
+	Vector3 lo = chunkRegions[c].box.lo;
+	Vector3 hi = chunkRegions[c].box.hi;
+	int moved = 0;
+	bool changed = false;
+	const int end = chunkEnd(c);
+	for (int i = c * DIRTY_CHUNK_SIZE; i < end; ++i)
+	{
+		const Vector3 pos = particles[i]->pos;
+		Vector3 & counted = countedPos[i];
+		Vector3 d = pos - counted;
+		if (d.dot(d) <= threshold)
+			continue;
+
+		// The box covers where the particle was last counted as well, that is
+		// what a consumer that skipped the chunk since still has
+		lo.x = std::min(lo.x, std::min(pos.x, counted.x));
+		lo.y = std::min(lo.y, std::min(pos.y, counted.y));
+		lo.z = std::min(lo.z, std::min(pos.z, counted.z));
+		hi.x = std::max(hi.x, std::max(pos.x, counted.x));
+		hi.y = std::max(hi.y, std::max(pos.y, counted.y));
+		hi.z = std::max(hi.z, std::max(pos.z, counted.z));
+		moved += !countedMoved[i];
+		countedMoved[i] = 1;
+		counted = pos;
+		changed = true;
+	}
+
+	if (!changed)
+		return;
+	DirtyRegion & region = chunkRegions[c];
+	region.box = Aabb(lo, hi);
+	region.moved += moved;
+	chunkVersions[c] = motionStamp;
+}
+
+// Each chunk is tracked right after it moved, while its particles are still in cache
+void ParticleSystem::advance(double dt, bool track)
+{
+	if (track)
+	{
+		beginMotion();
+		for (int c = 0; c < chunkRegions.size(); ++c)
+		{
+			const int end = chunkEnd(c);
+			for (int i = c * DIRTY_CHUNK_SIZE; i < end; ++i)
+				particles[i]->update(dt);
+			trackMotion(c);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < particles.size(); ++i)
+			particles[i]->update(dt);
+	}
+	clock += dt;
+}
+
+void ParticleSystem::markChunk(int c)
+{
+	fitChunks();
+	if (c < 0 || c >= chunkRegions.size())
+		return;
+
+	++motionStamp;
+	DirtyRegion & region = chunkRegions[c];
+	for (int i = c * DIRTY_CHUNK_SIZE; i < chunkEnd(c); ++i)
+	{
+		region.box.expand(countedPos[i]);
+		countedPos[i] = particles[i]->pos;
+		region.box.expand(countedPos[i]);
+		if (!countedMoved[i])
+		{
+			countedMoved[i] = 1;
+			++region.moved;
+		}
+	}
+	chunkVersions[c] = motionStamp;
+}
+
+void ParticleSystem::markAllChunks()
+{
+	fitChunks();
+	for (int c = 0; c < chunkRegions.size(); ++c)
+		markChunk(c);
+}
+
+void ParticleSystem::fitChunks()
+{
+	const int n = particles.size();
+	const int old = countedPos.size();
+	if (n == old)
+		return;
+
+	// New particles start out counted where they are, their chunks get marked below
+	countedPos.resize(n);
+	countedMoved.resize(n, 0);
+	externalForces.resize(n);
+	for (int i = old; i < n; ++i)
+		countedPos[i] = particles[i]->pos;
+	chunkRegions.resize((n + DIRTY_CHUNK_SIZE - 1) / DIRTY_CHUNK_SIZE);
+	chunkVersions.resize(chunkRegions.size(), 0);
+
+	// Sizes match now, so markChunk doesn't come back here
+	for (int c = std::min(old, n) / DIRTY_CHUNK_SIZE; c < chunkRegions.size(); ++c)
+		markChunk(c);
+}
+
 void updateParticleSystems(std::vector<ParticleSystem*> & psystems, double dt)
 {
 	for (int i = 0; i < psystems.size(); ++i)
 		psystems[i]->update(dt);
 }
 
+void updateParticleSystems(std::vector<ParticleSystem*> & psystems, double dt,
+							const TimestepLimits & limits, double ballSpeed)
+{
+	for (int i = 0; i < psystems.size(); ++i)
+		stepParticleSystem(psystems[i], dt, limits, ballSpeed);
+}
+
+void stepParticleSystem(ParticleSystem* ps, double dt, const TimestepLimits & limits, double ballSpeed)
+{
+	ps->pendingTime += dt;
+
+	double h = ps->stableTimestep(limits, ballSpeed);
+	h = std::max(limits.minDt, std::min(limits.maxDt, h));
+
+	// A calm system waits until it owes at least one whole step
+	if (ps->pendingTime < h)
+		return;
+
+	int steps = (int)std::ceil(ps->pendingTime / h);
+	double step = ps->pendingTime / steps;
+	ps->forceDt = dt;
+	for (int j = 0; j < steps; ++j)
+		ps->update(step);
+	ps->forceDt = 0.0;
+	ps->pendingTime = 0.0;
+}
+
 void cleanupParticleSystems(std::vector<ParticleSystem*> & psystems)
 {
 	for (int i = 0; i < psystems.size(); ++i)
 		psystems[i]->cleanup();
+	removeDoneParticleSystems(psystems);
+}
 
-	std::vector<ParticleSystem*> remaining(psystems.size());
+void removeDoneParticleSystems(std::vector<ParticleSystem*> & psystems)
+{
+	// Finished systems are dropped while compacting in place, keeping the order
 	int nsize = 0;
 	for (int i = 0; i < psystems.size(); ++i)
 	{
 		if (!psystems[i]->isDone())
 		{
-			remaining[nsize] = psystems[i];
+			psystems[nsize] = psystems[i];
 			++nsize;
 		}
 		else
 			delete psystems[i];
 	}
-	remaining.resize(nsize);
-	psystems = remaining;
+	psystems.resize(nsize);
+}
+
+void snapshotParticleSystems(const std::vector<ParticleSystem*> & psystems, FrameSnapshot & frame)
+{
+	frame.clear();
+	for (int i = 0; i < psystems.size(); ++i)
+		psystems[i]->snapshot(frame);
 }
 
 ////////////////////////////////////////
@@ -160,27 +504,8 @@ void cleanupParticleSystems(std::vector<ParticleSystem*> & psystems)
 
 // Spring Joint Constructor
 ParticleSystemSpringMass::SpringJoint::SpringJoint(Particle* p1, Particle* p2, double k, double d, double l)
-	: particle1(p1), particle2(p2), stiffness(k), length(l), damp(d)
-{
-}
-
-// Spring Joint function to calculate force
-Vector3 ParticleSystemSpringMass::SpringJoint::calculateSpringForce() const
+	: particle1(p1), particle2(p2), index1(-1), index2(-1), stiffness(k), length(l), damp(d)
 {
-	double kd = this->damp;
-	double ks = this->stiffness;
-	Vector3 p1 = particle1->pos;
-	Vector3 p2 = particle2->pos;
-	Vector3 v1 = particle1->vel;
-	Vector3 v2 = particle2->vel;
-
-	Vector3 x = p2-p1;
-	Vector3 b = v2-v1;
-	
-	Vector3 fspring = x * ks * -1.0;
-	Vector3 fdamp = b * kd * -1.0;
-	Vector3 f = fspring + fdamp;
-	return f;
 }
 
 // Spring Joint render function
@@ -197,12 +522,27 @@ void ParticleSystemSpringMass::SpringJoint::render() const
 }
 
 // ParticleSystemSpringMass Constructor
-ParticleSystemSpringMass::ParticleSystemSpringMass(const Vector3 & startingLocation)
-	: ParticleSystem(startingLocation), springConnections()
+ParticleSystemSpringMass::ParticleSystemSpringMass(const Vector3 & startingLocation, int gridSize,
+														ReorderMethod reorderMethod)
+	: ParticleSystem(startingLocation), springConnections(), gatherForces(false), gridSize(gridSize),
+	  reorderMethod(reorderMethod), reorderInterval(0), integrator(INTEGRATE_EXPLICIT), solver(),
+	  reducedInterval(8), springAdjacency(), gridCells(), solverStale(true), chunkSprings(), chunkSpringOffsets(),
+	  currentDetail(DETAIL_FULL), reducedFrame(0), springForces(), maxStiffnessRate(0.0), maxDampingRate(0.0),
+	  stepsSinceReorder(0)
 {
 	init();
 } 
 
+ParticleSystemSpringMass::ParticleSystemSpringMass(const SpawnParams & params, Particle* storage)
+	: ParticleSystem(params.location), springConnections(), gatherForces(false), gridSize(params.gridSize),
+	  reorderMethod(params.reorderMethod), reorderInterval(0), integrator(INTEGRATE_EXPLICIT), solver(),
+	  reducedInterval(8), springAdjacency(), gridCells(), solverStale(true), chunkSprings(), chunkSpringOffsets(),
+	  currentDetail(DETAIL_FULL), reducedFrame(0), springForces(), maxStiffnessRate(0.0), maxDampingRate(0.0),
+	  stepsSinceReorder(0)
+{
+	initGrid(storage);
+}
+
 // ParticleSystemSpringMass Destructor
 ParticleSystemSpringMass::~ParticleSystemSpringMass()
 {
@@ -211,9 +551,21 @@ ParticleSystemSpringMass::~ParticleSystemSpringMass()
 // ParticleSystemSpringMass initialization function
 void ParticleSystemSpringMass::init()
 {
-	const int NUM_PARTICLES = 10;
+	initGrid(NULL);
+}
+
+void ParticleSystemSpringMass::initGrid(Particle* storage)
+{
+	const int NUM_PARTICLES = gridSize;
 	particles = std::vector<Particle*>();
 	springConnections = std::vector<SpringJoint>();
+	gridCells = std::vector<int>();
+	particles.reserve(NUM_PARTICLES * NUM_PARTICLES);
+	gridCells.reserve(NUM_PARTICLES * NUM_PARTICLES);
+	springConnections.reserve(2 * NUM_PARTICLES * (NUM_PARTICLES - 1) + 2 * (NUM_PARTICLES - 1) * (NUM_PARTICLES - 1));
+
+	// Every strand particle looks the same, so they share one entry
+	looks = std::vector<ParticleLook>(1, ParticleLook(Color4(0.0, 1.0, 0.0, 1.0), 1.0));
 	for(int i = 0; i < NUM_PARTICLES; ++i)
 	{  
 	    for(int j = 0; j < NUM_PARTICLES; ++j)
@@ -240,35 +592,366 @@ void ParticleSystemSpringMass::init()
 		    Vector3 acc = Vector3();
 		    double mass = 2.0;
 		    double time = 90.0;
-		    double size = 1.0;
 		    double stiffness = 1.8;     //3.8
 		    double damp = 5.0;          //5.0
-		    Color4 col = Color4(0.0, 1.0, 0.0, 1.0);
 
-		    Particle* p = new Particle(pos, vel, acc, mass, time, size, col);
+		    Particle* p;
+		    if (storage != NULL)
+		        p = new (storage + particles.size()) Particle(pos, vel, acc, mass, time);
+		    else
+		        p = new Particle(pos, vel, acc, mass, time);
 		    particles.push_back(p);
+		    gridCells.push_back(i * NUM_PARTICLES + j);
 		    
+		    // Springs know the list positions of their ends from the start
+		    auto link = [&](int a, int b)
+		    {
+		        SpringJoint s(particles[a], particles[b], stiffness, damp, magnitude);
+		        s.index1 = a;
+		        s.index2 = b;
+		        springConnections.push_back(s);
+		    };
+
             if(i > 0)
-		        springConnections.push_back(SpringJoint(particles[(i-1)*NUM_PARTICLES+j], particles[i*NUM_PARTICLES+j], stiffness, damp, magnitude));
+		        link((i-1)*NUM_PARTICLES+j, i*NUM_PARTICLES+j);
 		    
 		    if(j > 0)
-		        springConnections.push_back(SpringJoint(particles[i*NUM_PARTICLES+(j-1)], particles[i*NUM_PARTICLES+j], stiffness, damp, magnitude));
+		        link(i*NUM_PARTICLES+(j-1), i*NUM_PARTICLES+j);
 
 		   
 		    if(i > 0 && j > 0)
 		    {
-		       springConnections.push_back(SpringJoint(particles[(i-1)*NUM_PARTICLES+(j-1)], particles[i*NUM_PARTICLES+j], stiffness, damp, magnitude));
-		       springConnections.push_back(SpringJoint(particles[(i)*NUM_PARTICLES+(j-1)], particles[(i-1)*NUM_PARTICLES+(j)], stiffness, damp, magnitude));
+		       link((i-1)*NUM_PARTICLES+(j-1), i*NUM_PARTICLES+j);
+		       link((i)*NUM_PARTICLES+(j-1), (i-1)*NUM_PARTICLES+(j));
 		    }
 		    
 		}
 	}
+
+	rebuildAdjacency();
+	if (reorderMethod != REORDER_NONE)
+		reorder(reorderMethod);
+}
+
+// ParticleSystemSpringMass spawn function
+void ParticleSystemSpringMass::spawn(const std::vector<SpawnParams> & params,
+										std::vector<ParticleSystem*> & psystems, int threads)
+{
+	if (params.empty())
+		return;
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	threads = std::min(threads, (int)params.size());
+
+	// Each system gets the slice of the block starting at first[i]
+	std::vector<size_t> first(params.size() + 1, 0);
+	for (int i = 0; i < params.size(); ++i)
+		first[i + 1] = first[i] + params[i].gridSize * params[i].gridSize;
+	std::shared_ptr<ParticleBlock> block = std::make_shared<ParticleBlock>(first.back());
+
+	// Threads fill disjoint ranges of built, nothing else is shared while building
+	std::vector<ParticleSystem*> built(params.size());
+	auto build = [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			ParticleSystemSpringMass* ps = new ParticleSystemSpringMass(params[i], block->begin + first[i]);
+			ps->block = block;
+			built[i] = ps;
+		}
+	};
+
+	int chunk = (params.size() + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	for (int begin = chunk; begin < params.size(); begin += chunk)
+		workers.push_back(std::thread(build, begin, std::min(begin + chunk, (int)params.size())));
+	build(0, chunk);
+	for (int i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	psystems.insert(psystems.end(), built.begin(), built.end());
+}
+
+// Builds the CSR adjacency from the spring list
+void ParticleSystemSpringMass::rebuildAdjacency()
+{
+	const int n = particles.size();
+
+	// Spring indices set by initGrid() or reorder() are still right, only
+	// springs added or moved since need looking up
+	std::map<const Particle*, int> index;
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		SpringJoint & s = springConnections[i];
+		if (s.index1 >= 0 && s.index1 < n && particles[s.index1] == s.particle1 &&
+			s.index2 >= 0 && s.index2 < n && particles[s.index2] == s.particle2)
+			continue;
+		if (index.empty())
+			for (int j = 0; j < n; ++j)
+				index[particles[j]] = j;
+		s.index1 = index[s.particle1];
+		s.index2 = index[s.particle2];
+	}
+
+	SpringAdjacency & adj = springAdjacency;
+	adj.offsets.assign(particles.size() + 1, 0);
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		const SpringJoint & s = springConnections[i];
+		++adj.offsets[s.index1 + 1];
+		++adj.offsets[s.index2 + 1];
+	}
+	for (int i = 0; i < particles.size(); ++i)
+		adj.offsets[i + 1] += adj.offsets[i];
+
+	// Fill each particle's row, next[i] is the first free slot in row i
+	std::vector<int> next(adj.offsets.begin(), adj.offsets.end() - 1);
+	adj.springs.resize(2 * springConnections.size());
+	adj.neighbors.resize(2 * springConnections.size());
+	adj.signs.resize(2 * springConnections.size());
+	springForces.resize(springConnections.size());
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		const SpringJoint & s = springConnections[i];
+		int k = next[s.index1]++;
+		adj.springs[k] = i;
+		adj.neighbors[k] = s.index2;
+		adj.signs[k] = -1.0;
+
+		k = next[s.index2]++;
+		adj.springs[k] = i;
+		adj.neighbors[k] = s.index1;
+		adj.signs[k] = 1.0;
+	}
+
+	maxStiffnessRate = 0.0;
+	maxDampingRate = 0.0;
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		double stiffness = 0.0;
+		double damping = 0.0;
+		for (int k = adj.offsets[i]; k < adj.offsets[i + 1]; ++k)
+		{
+			stiffness += springConnections[adj.springs[k]].stiffness;
+			damping += springConnections[adj.springs[k]].damp;
+		}
+		maxStiffnessRate = std::max(maxStiffnessRate, stiffness / particles[i]->mass);
+		maxDampingRate = std::max(maxDampingRate, damping / particles[i]->mass);
+	}
+	solverStale = true;
+
+	// A spring is drawn with the chunk of its lower end
+	const int chunks = (particles.size() + DIRTY_CHUNK_SIZE - 1) / DIRTY_CHUNK_SIZE;
+	chunkSpringOffsets.assign(chunks + 1, 0);
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		const SpringJoint & s = springConnections[i];
+		++chunkSpringOffsets[std::min(s.index1, s.index2) / DIRTY_CHUNK_SIZE + 1];
+	}
+	for (int c = 0; c < chunks; ++c)
+		chunkSpringOffsets[c + 1] += chunkSpringOffsets[c];
+	next.assign(chunkSpringOffsets.begin(), chunkSpringOffsets.end() - 1);
+	chunkSprings.resize(springConnections.size());
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		const SpringJoint & s = springConnections[i];
+		chunkSprings[next[std::min(s.index1, s.index2) / DIRTY_CHUNK_SIZE]++] = i;
+	}
+
+	// Whatever consumers had of this system may be numbered differently now
+	markAllChunks();
+}
+
+// Interleaves the low 21 bits of v with two zero bits between each
+static unsigned long long spreadBits(unsigned long long v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+
+// Particle indices sorted along a Morton curve through their positions
+static std::vector<int> mortonOrder(const std::vector<Particle*> & particles)
+{
+	Vector3 lo = particles[0]->pos;
+	Vector3 hi = particles[0]->pos;
+	for (int i = 1; i < particles.size(); ++i)
+	{
+		const Vector3 & p = particles[i]->pos;
+		lo = Vector3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+		hi = Vector3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+	}
+	// One scale for all axes keeps the curve from stretching
+	double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+	double scale = extent > 0.0 ? 2097151.0 / extent : 0.0;
+
+	std::vector<std::pair<unsigned long long, int> > codes(particles.size());
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		Vector3 q = (particles[i]->pos - lo) * scale;
+		codes[i].first = spreadBits((unsigned long long)q.x) |
+						spreadBits((unsigned long long)q.y) << 1 |
+						spreadBits((unsigned long long)q.z) << 2;
+		codes[i].second = i;
+	}
+	std::sort(codes.begin(), codes.end());
+
+	std::vector<int> order(particles.size());
+	for (int i = 0; i < codes.size(); ++i)
+		order[i] = codes[i].second;
+	return order;
+}
+
+// Reverse Cuthill-McKee ordering of the spring graph: a breadth first search
+// from a least connected particle, visiting neighbours by increasing degree
+static std::vector<int> rcmOrder(const ParticleSystemSpringMass::SpringAdjacency & adj, int n)
+{
+	std::vector<int> degree(n);
+	std::vector<int> byDegree(n);
+	for (int i = 0; i < n; ++i)
+	{
+		degree[i] = adj.offsets[i + 1] - adj.offsets[i];
+		byDegree[i] = i;
+	}
+	std::stable_sort(byDegree.begin(), byDegree.end(),
+		[&degree](int a, int b) { return degree[a] < degree[b]; });
+
+	std::vector<int> order;
+	order.reserve(n);
+	std::vector<bool> visited(n, false);
+	std::vector<int> neighbors;
+	for (int s = 0; s < n; ++s)
+	{
+		// Each disconnected piece starts from its least connected particle
+		if (visited[byDegree[s]])
+			continue;
+		visited[byDegree[s]] = true;
+		order.push_back(byDegree[s]);
+		for (int head = order.size() - 1; head < order.size(); ++head)
+		{
+			int i = order[head];
+			neighbors.clear();
+			for (int k = adj.offsets[i]; k < adj.offsets[i + 1]; ++k)
+			{
+				if (!visited[adj.neighbors[k]])
+				{
+					visited[adj.neighbors[k]] = true;
+					neighbors.push_back(adj.neighbors[k]);
+				}
+			}
+			std::stable_sort(neighbors.begin(), neighbors.end(),
+				[&degree](int a, int b) { return degree[a] < degree[b]; });
+			order.insert(order.end(), neighbors.begin(), neighbors.end());
+		}
+	}
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+// ParticleSystemSpringMass reorder function
+void ParticleSystemSpringMass::reorder(ReorderMethod method)
+{
+	stepsSinceReorder = 0;
+	if (method == REORDER_NONE || particles.empty())
+		return;
+
+	if (method == REORDER_MORTON)
+		reorder(mortonOrder(particles));
+	else
+		reorder(rcmOrder(springAdjacency, particles.size()));
+}
+
+// ParticleSystemSpringMass reorder function
+void ParticleSystemSpringMass::reorder(const std::vector<int> & order)
+{
+	// Move the particle contents so the objects at the front of the list,
+	// which were allocated first, hold the first particles in the new order
+	std::vector<Particle> data(particles.size());
+	for (int i = 0; i < particles.size(); ++i)
+		data[i] = *particles[order[i]];
+	for (int i = 0; i < particles.size(); ++i)
+		*particles[i] = data[i];
+
+	if (gridCells.size() == particles.size())
+	{
+		std::vector<int> oldCells(gridCells);
+		for (int i = 0; i < gridCells.size(); ++i)
+			gridCells[i] = oldCells[order[i]];
+	}
+
+	if (looks.size() > 1)
+	{
+		std::vector<ParticleLook> oldLooks(looks);
+		for (int i = 0; i < looks.size(); ++i)
+			looks[i] = oldLooks[order[i]];
+	}
+
+	if (externalForces.size() == particles.size())
+	{
+		std::vector<ExternalForces> oldForces(externalForces);
+		for (int i = 0; i < externalForces.size(); ++i)
+			externalForces[i] = oldForces[order[i]];
+	}
+
+	std::vector<int> newIndex(particles.size());
+	for (int i = 0; i < particles.size(); ++i)
+		newIndex[order[i]] = i;
+
+	// Handles follow the particles to their new positions
+	trackNewParticles();
+	std::vector<int> oldSlots(particleSlots);
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		particleSlots[i] = oldSlots[order[i]];
+		handleSlots[particleSlots[i]].index = i;
+	}
+
+	// Point the springs at the new slots with the lower index first, swapping
+	// ends just flips the sign of calculateSpringForce which both ends share
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		SpringJoint & s = springConnections[i];
+		int a = newIndex[s.index1];
+		int b = newIndex[s.index2];
+		s.index1 = std::min(a, b);
+		s.index2 = std::max(a, b);
+		s.particle1 = particles[s.index1];
+		s.particle2 = particles[s.index2];
+	}
+	std::sort(springConnections.begin(), springConnections.end(),
+		[](const SpringJoint & a, const SpringJoint & b)
+		{ return a.index1 < b.index1 || (a.index1 == b.index1 && a.index2 < b.index2); });
+
+	rebuildAdjacency();
 }
 
-// ParticleSystemSpringMass update function
-void ParticleSystemSpringMass::update(double dt)
+// ParticleSystemSpringMass springSpan function
+double ParticleSystemSpringMass::springSpan() const
+{
+	if (springConnections.empty())
+		return 0.0;
+	double total = 0.0;
+	for (int i = 0; i < springConnections.size(); ++i)
+		total += std::abs(springConnections[i].index2 - springConnections[i].index1);
+	return total / springConnections.size();
+}
+
+// ParticleSystemSpringMass force function, integrating is left to the base class
+void ParticleSystemSpringMass::applyForces(double dt)
 {
 	// *** Complete this function
+	// At reduced detail only the frame that steps needs forces
+	if (currentDetail == DETAIL_REDUCED && reducedFrame != 0)
+		return;
+
+	// Particles drift apart from their neighbours in a Morton order as they move
+	if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval)
+		reorder(reorderMethod);
+
 	// Reset by zeroing out the acceleration vector
 	for (int i = 0; i < particles.size(); ++i)
 	{
@@ -282,26 +965,177 @@ void ParticleSystemSpringMass::update(double dt)
 	    particles[i]->applyForce(Vector3(0.0, 28.0, 0.0));
 	    
 	    //enviroment force
-	    particles[i]->applyForce(particles[i]->enviromentForce);
+	    particles[i]->applyForce(externalForces[i].enviromentForce);
 	    
 	}
+    //ball forces are gathered over a frame, when that is split into several
+    //steps the first one delivers the whole frame's push
+    double ballScale = forceDt > 0.0 ? forceDt / dt : 1.0;
+    //a reduced step spans reducedInterval frames and delivers their pushes at once
+    if (currentDetail == DETAIL_REDUCED)
+        ballScale /= reducedInterval;
     for(int i = 0; i < particles.size(); ++i)
     {
 	    //force applied by balls
-	    particles[i]->applyForces(particles[i]->ballForce);
-	    particles[i]->ballForce.clear();
+	    particles[i]->applyForce(externalForces[i].ballForce * ballScale);
+	    externalForces[i].ballForce = Vector3();
 	}
 	
-	for(int i = 0; i < springConnections.size(); ++i)
+	if (gatherForces)
+	{
+		// Every spring's force is computed once, then each particle sums the
+		// springs in its own row, so no two iterations write to the same place
+		computeSpringForces();
+		gatherSpringForces();
+	}
+	else
 	{
-	    Vector3 fa = springConnections[i].calculateSpringForce();
-	    Vector3 fb = fa * -1.0;
+		for(int i = 0; i < springConnections.size(); ++i)
+		{
+		    Vector3 fa = springConnections[i].calculateSpringForce();
+		    Vector3 fb = fa * -1.0;
 
-	    springConnections[i].particle1->applyForce(fb);
-	    springConnections[i].particle2->applyForce(fa);
+		    springConnections[i].particle1->applyForce(fb);
+		    springConnections[i].particle2->applyForce(fa);
+		}
+	}
+}
+
+// ParticleSystemSpringMass resolveCollisions function
+void ParticleSystemSpringMass::resolveCollisions()
+{
+	// The in-between states of reduced detail are only for show
+	if (currentDetail == DETAIL_REDUCED && reducedFrame != 0)
+		return;
+	ParticleSystem::resolveCollisions();
+}
+
+// ParticleSystemSpringMass integrate function
+void ParticleSystemSpringMass::integrate(double dt)
+{
+	if (currentDetail == DETAIL_FULL)
+	{
+		integrateWith(dt, integrator, true);
+		return;
+	}
+
+	// The first frame of an interval steps over the whole interval at once,
+	// implicitly since that is far past the explicit limit. A backward Euler
+	// step moves each particle at its new velocity, so showing it a share of
+	// the way further every frame keeps positions and velocities consistent
+	const int n = particles.size();
+	if (reducedFrame == 0)
+	{
+		reducedStep.resize(n);
+		reducedEnd.resize(n);
+		for (int i = 0; i < n; ++i)
+			reducedStep[i] = particles[i]->pos;
+		// Only where the particles are shown counts as motion, not the interval's end
+		integrateWith(dt * reducedInterval, INTEGRATE_IMPLICIT, false);
+		for (int i = 0; i < n; ++i)
+		{
+			reducedEnd[i] = particles[i]->pos;
+			reducedStep[i] = (reducedEnd[i] - reducedStep[i]) / reducedInterval;
+			particles[i]->pos = reducedEnd[i] - reducedStep[i] * (reducedInterval - 1);
+		}
+	}
+	else if (reducedFrame + 1 < reducedInterval)
+	{
+		for (int i = 0; i < n; ++i)
+			particles[i]->pos += reducedStep[i];
+	}
+	else
+	{
+		for (int i = 0; i < n; ++i)
+			particles[i]->pos = reducedEnd[i];
+	}
+
+	beginMotion();
+	for (int c = 0; c < chunkCount(); ++c)
+		trackMotion(c);
+
+	if (++reducedFrame >= reducedInterval)
+		reducedFrame = 0;
+}
+
+// ParticleSystemSpringMass setDetail function
+void ParticleSystemSpringMass::setDetail(Detail d)
+{
+	if (d == currentDetail)
+		return;
+	currentDetail = d;
+	reducedFrame = 0;
+}
+
+// Implicitly the step solves
+//     (M + h D + h^2 K) dv = h (f - h K v)
+// for the velocity change, f being the forces applyForces left in acc
+void ParticleSystemSpringMass::integrateWith(double dt, Integrator method, bool track)
+{
+	if (method == INTEGRATE_EXPLICIT || dt <= 0.0)
+	{
+		advance(dt, track);
+		return;
+	}
+
+	const int n = particles.size();
+	if (solverStale)
+	{
+		std::vector<double> masses(n);
+		for (int i = 0; i < n; ++i)
+			masses[i] = particles[i]->mass;
+		std::vector<SolverSpring> springs;
+		springs.reserve(springConnections.size());
+		for (int i = 0; i < springConnections.size(); ++i)
+		{
+			const SpringJoint & s = springConnections[i];
+			springs.push_back(SolverSpring(s.index1, s.index2, s.stiffness, s.damp));
+		}
+		solver.build(masses, springs, gridCells, gridSize, gridSize);
+		solverStale = false;
+	}
+
+	implicitRhs.resize(n);
+	implicitLocked.resize(n);
+	for (int i = 0; i < n; ++i)
+	{
+		implicitRhs[i] = particles[i]->acc * (particles[i]->mass * dt);
+		implicitLocked[i] = particles[i]->isLocked;
+	}
+	for (int i = 0; i < springConnections.size(); ++i)
+	{
+		const SpringJoint & s = springConnections[i];
+		Vector3 d = (s.particle2->vel - s.particle1->vel) * (s.stiffness * dt * dt);
+		implicitRhs[s.index1] += d;
+		implicitRhs[s.index2] -= d;
+	}
+
+	solver.solve(dt, implicitRhs, implicitLocked, implicitDv);
+
+	// As an acceleration the velocity change goes through Particle::update like any other
+	for (int i = 0; i < n; ++i)
+		particles[i]->acc = implicitDv[i] / dt;
+	advance(dt, track);
+}
+
+// Fills springForces with the force of every spring on its particle2
+void ParticleSystemSpringMass::computeSpringForces()
+{
+	for (int i = 0; i < springConnections.size(); ++i)
+		springForces[i] = springConnections[i].calculateSpringForce();
+}
+
+// Applies to each particle the sum of springForces over its CSR row
+void ParticleSystemSpringMass::gatherSpringForces()
+{
+	const SpringAdjacency & adj = springAdjacency;
+	for (int i = 0; i < particles.size(); ++i)
+	{
+		Vector3 f;
+		for (int k = adj.offsets[i]; k < adj.offsets[i + 1]; ++k)
+			f.addScaled(springForces[adj.springs[k]], adj.signs[k]);
+		particles[i]->applyForce(f);
 	}
-		
-	ParticleSystem::update(dt);
 }
 
 // ParticleSystemSpringMass render function
@@ -310,7 +1144,7 @@ void ParticleSystemSpringMass::render() const
 	// *** Complete this function
 	for (int i = 0; i < particles.size(); ++i)
 	{
-		particles[i]->render();
+		particles[i]->render(look(i));
     }
     for(int i = 0; i < springConnections.size(); ++i)
     {
@@ -318,6 +1152,54 @@ void ParticleSystemSpringMass::render() const
     }
 }
 
+// ParticleSystemSpringMass snapshot function
+void ParticleSystemSpringMass::snapshot(FrameSnapshot & frame)
+{
+	// Springs refer to particles by index into the frame, so remember where ours start
+	int base = frame.particles.size();
+	int firstChunk = frame.chunks.size();
+	ParticleSystem::snapshot(frame);
+
+	// Each chunk's springs follow one another. A spring also changes with the
+	// chunk at its other end, versions only go up so the chunk takes the newest
+	const int chunks = std::min((int)(frame.chunks.size() - firstChunk), (int)chunkSpringOffsets.size() - 1);
+	for (int c = 0; c < chunks; ++c)
+	{
+		ChunkSnapshot & cs = frame.chunks[firstChunk + c];
+		cs.firstSpring = frame.springs.size();
+		for (int k = chunkSpringOffsets[c]; k < chunkSpringOffsets[c + 1]; ++k)
+		{
+			const SpringJoint & s = springConnections[chunkSprings[k]];
+			SpringSnapshot ss;
+			ss.particle1 = base + s.index1;
+			ss.particle2 = base + s.index2;
+			frame.springs.push_back(ss);
+			cs.version = std::max(cs.version, chunkVersions[std::max(s.index1, s.index2) / DIRTY_CHUNK_SIZE]);
+		}
+		cs.springCount = frame.springs.size() - cs.firstSpring;
+	}
+}
+
+// ParticleSystemSpringMass stableTimestep function
+double ParticleSystemSpringMass::stableTimestep(const TimestepLimits & limits, double ballSpeed) const
+{
+	// The ball only matters to systems it is touching this frame
+	bool hit = false;
+	for (int i = 0; i < externalForces.size() && !hit; ++i)
+		hit = externalForces[i].ballForce.dot(externalForces[i].ballForce) > 0.0;
+	double h = ParticleSystem::stableTimestep(limits, hit ? ballSpeed : 0.0);
+
+	// Symplectic Euler on a spring is stable for dt < 2 / omega and, for the
+	// damping, dt < 2 / (damping / mass). Implicit steps have no such limit
+	if (integrator == INTEGRATE_IMPLICIT || currentDetail == DETAIL_REDUCED)
+		return h;
+	if (maxStiffnessRate > 0.0)
+		h = std::min(h, limits.courant * 2.0 / std::sqrt(maxStiffnessRate));
+	if (maxDampingRate > 0.0)
+		h = std::min(h, limits.courant * 2.0 / maxDampingRate);
+	return h;
+}
+
 // ParticleSystemSpringMass cleanup function
 void ParticleSystemSpringMass::cleanup()
 {
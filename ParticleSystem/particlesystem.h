@@ -3,41 +3,109 @@
 
 #include "vector3.h"
 #include "color.h"
+#include "particlelook.h"
+#include "snapshot.h"
+#include "collider.h"
+#include "springsolver.h"
 
 #include <vector>
 #include <map>
+#include <queue>
+#include <functional>
+#include <memory>
  
 // Particle information and its functions
+// Only what a simulation step touches lives here, render attributes and the
+// forces set from outside are kept by the particle system (ParticleLook and
+// ExternalForces)
 struct Particle
 {
+	// Read and written by every step
 	Vector3 pos;
 	Vector3 vel;
 	Vector3 acc;
 	double mass;
-	bool isLocked;
-	std::vector<Vector3> ballForce;
-	Vector3 enviromentForce;
 	// For particles which may expire can use this value to countdown
 	double timer;
-
-	// Size of the particle to render on the screen
-	double size;
-	
-	// Color of the particle
-	Color4 col;
+	bool isLocked;
 	
 	// Functions which add to the particle's acceleration
 	void applyForce(const Vector3 & force);
-	void applyForces(const std::vector<Vector3> & forces);
 
 	Particle(const Vector3 & p = Vector3(), 
 				const Vector3 & v = Vector3(), 
 				const Vector3 & a = Vector3(), double m = 1.0, 
-				double t = 1.0, double sz = 1.0, const Color4 & c = Color4());
+				double t = 1.0);
 	void update(double dt);
-	void render() const;
+	void render(const ParticleLook & look) const;
+};
+
+// Forces set on a particle between steps and read once per step
+struct ExternalForces
+{
+	// Sum of the pushes from balls since the last update
+	Vector3 ballForce;
+	Vector3 enviromentForce;
+};
+
+// Bounds for adaptive stepping, all times in seconds
+struct TimestepLimits
+{
+	// Range a system's step is clamped to
+	double minDt;
+	double maxDt;
+
+	// Safety factor (< 1) applied to every stability estimate
+	double courant;
+
+	// Furthest a particle may move relative to its surroundings in one step
+	double maxTravel;
+
+	TimestepLimits(double minDt = 0.002, double maxDt = 0.1,
+					double courant = 0.5, double maxTravel = 1.0);
 };
 
+// Refers to a particle for as long as it lives, even while the particles list
+// is compacted around it. Once the particle is removed the handle goes stale
+// (its generation no longer matches) instead of pointing at another particle
+struct ParticleHandle
+{
+	int slot;
+	int generation;
+
+	ParticleHandle()
+		: slot(-1), generation(0)
+	{}
+	ParticleHandle(int slot, int generation)
+		: slot(slot), generation(generation)
+	{}
+};
+
+// One allocation holding the particles of many systems built together
+// (see ParticleSystemSpringMass::spawn). The particles are constructed in place
+// by their systems, and the memory is freed when the last system sharing it goes away.
+// Only the particles live here, each system still allocates its own springs,
+// adjacency and other per-particle lists
+struct ParticleBlock
+{
+	Particle* begin;
+	Particle* end;
+
+	// Reserves room for count particles without constructing them
+	ParticleBlock(size_t count);
+	~ParticleBlock();
+
+	bool contains(const Particle* p) const { return p >= begin && p < end; }
+
+private:
+	// Not copyable, the memory is owned by exactly one block
+	ParticleBlock(const ParticleBlock &);
+	ParticleBlock & operator=(const ParticleBlock &);
+};
+
+// Particles per chunk of the dirty tracking, see ParticleSystem::chunkDirty
+const int DIRTY_CHUNK_SIZE = 32;
+
 // Base class for a Particle System
 class ParticleSystem
 {
@@ -49,6 +117,29 @@ protected:
 public:
 	Vector3 location;
 	std::vector<Particle*> particles;
+
+	// How the particles are drawn: either one entry shared by all of them
+	// or one per particle, in the same order as particles
+	std::vector<ParticleLook> looks;
+
+	// Forces from outside on each particle, in the same order as particles.
+	// Particles pushed straight onto the list get theirs along with their chunks
+	std::vector<ExternalForces> externalForces;
+
+	// Simulation time this system still owes when stepping adaptively
+	double pendingTime;
+
+	// Length of the frame the ball forces were gathered over while stepParticleSystem
+	// splits it into steps of its own, 0 when each step is a whole frame
+	double forceDt;
+
+	// What the particles bounce off, defaultColliders() unless set (NULL for nothing)
+	const ColliderSet * colliders;
+
+	// A particle that moved less than this since it last counted as moved doesn't
+	// count, so strands settling by tiny amounts don't keep their chunks dirty
+	double motionThreshold;
+
 	ParticleSystem(const Vector3 & startingLocation = Vector3());
 	virtual ~ParticleSystem();
 
@@ -57,22 +148,165 @@ public:
 	// Initializes the particle system generating particles and any other information
 	virtual void init() = 0;
 
-	// Calculates any forces and updates all particles
+	// The look of particle i
+	const ParticleLook & look(int i) const { return looks.size() == 1 ? looks[0] : looks[i]; }
+
+	// Calculates the forces on all particles for a step of dt (there are none unless overriden)
+	virtual void applyForces(double dt);
+
+	// Pushes the particles out of the colliders and takes away their speed into them
+	virtual void resolveCollisions();
+
+	// Moves all particles by dt under the forces applied
+	virtual void integrate(double dt);
+
+	// Calculates any forces and updates all particles: applyForces, resolveCollisions then integrate
 	virtual void update(double dt);
 
 	// Renders all particles and anything else particular to that particle system
 	virtual void render() const;
 
-	// Scans the list of particles and removes expired particles (unless overriden)
+	// Appends a read-only copy of the current state to a frame snapshot. Particles
+	// pushed straight onto the list since the last step have their chunks marked first
+	virtual void snapshot(FrameSnapshot & frame);
+
+	// Largest step that keeps this system stable and accurate right now.
+	// The base version is a CFL bound on particle speed, ballSpeed is the speed
+	// of the fastest thing that may hit the particles
+	virtual double stableTimestep(const TimestepLimits & limits, double ballSpeed) const;
+
+	// Removes the particles whose timer has run out (unless overriden).
+	// Only particles that are due are looked at, nothing is done when none are
 	virtual void cleanup();
 
 	// If there are no more particles in the list, the particle system is done
 	virtual bool isDone() const;
+
+	// Box around all the particles, empty when there are none
+	Aabb bounds() const;
+
+	// Unique among all the systems made, names the system's chunks in snapshots
+	unsigned id() const { return systemId; }
+
+	// Dirty tracking. The particles list is split into chunks of DIRTY_CHUNK_SIZE
+	// and every integrate() notes which particles moved in each. Adding, removing
+	// or renumbering particles counts every particle of the chunks involved as moved
+	int chunkCount() const { return chunkRegions.size(); }
+
+	// Motion of chunk c, and of the whole system, since the last clearDirty()
+	const DirtyRegion & chunkDirty(int c) const { return chunkRegions[c]; }
+	DirtyRegion dirty() const;
+
+	// Changes whenever chunk c does and never repeats, so a consumer can hold on to
+	// the version it last saw instead of seeing every clearDirty()
+	unsigned chunkVersion(int c) const { return chunkVersions[c]; }
+
+	// Empties the dirty regions, the versions carry on
+	void clearDirty();
+
+	// Adds a particle and returns its handle, its chunk counts as changed.
+	// Particles pushed straight onto the particles list also work, they get a
+	// handle at the next cleanup and their chunks are marked by the next
+	// integrate, cleanup or snapshot, whichever comes first
+	ParticleHandle addParticle(Particle* p);
+
+	// Deletes particle i, the last particle takes its place in the list
+	void removeParticle(int i);
+
+	// The handle of particle i
+	ParticleHandle handle(int i);
+
+	// Current position in the particles list of a handle, or -1 if it is stale
+	int indexOf(const ParticleHandle & h) const;
+
+	// The particle a handle refers to, or NULL if it has been removed
+	Particle* find(const ParticleHandle & h) const;
+
+	// Call after changing the timer of particle i so cleanup sees the new expiry
+	void retime(int i);
+
+protected:
+	// An entry of the handle table, index is -1 while the slot is free
+	struct HandleSlot
+	{
+		int index;
+		int generation;
+	};
+
+	// A particle due to expire at the given simulation time
+	struct Expiry
+	{
+		double time;
+		int slot;
+		int generation;
+
+		Expiry(double time, int slot, int generation)
+			: time(time), slot(slot), generation(generation)
+		{}
+		bool operator>(const Expiry & rhs) const { return time > rhs.time; }
+	};
+
+	// Gives handles and expiry entries to particles added straight to the list
+	void trackNewParticles();
+
+	// Moves the particles by dt, noting their motion as integrate() does when track is set
+	void advance(double dt, bool track);
+
+	// Notes the particles of chunk c that moved since they last counted, once
+	// beginMotion() has started the pass over the chunks
+	void beginMotion();
+	void trackMotion(int c);
+
+	// One past the last particle of chunk c
+	int chunkEnd(int c) const;
+
+	// Counts every particle of chunk c as moved, or of every chunk. Both first
+	// fit the chunks, and externalForces, to particles added straight to the list
+	// or removed
+	void markChunk(int c);
+	void markAllChunks();
+	void fitChunks();
+
+	// Frees a particle unless it lives in the shared block
+	void destroyParticle(Particle* p);
+
+	// Shared storage some of the particles were built in, if any
+	std::shared_ptr<ParticleBlock> block;
+
+	// Simulation time this system has been advanced by
+	double clock;
+
+	std::vector<HandleSlot> handleSlots;
+	std::vector<int> freeSlots;
+	// Handle slot of each particle, in the same order as particles
+	std::vector<int> particleSlots;
+	// Min-heap of expiry times, entries of removed particles are skipped when they come up
+	std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry> > expiries;
+
+	unsigned systemId;
+	// Where each particle was when it last counted as moved, and whether it
+	// already has since the last clearDirty()
+	std::vector<Vector3> countedPos;
+	std::vector<char> countedMoved;
+	std::vector<DirtyRegion> chunkRegions;
+	std::vector<unsigned> chunkVersions;
+	// Goes up with every beginMotion() and markChunk(), versions are taken from it
+	unsigned motionStamp;
 };
 
 // Main functions to update and clean all particle systems
 void updateParticleSystems(std::vector<ParticleSystem*> & psystems, double dt);
+// Advances every system by dt using its own step size: calm systems wait and
+// take one step of up to limits.maxDt, busy ones take several smaller steps
+void updateParticleSystems(std::vector<ParticleSystem*> & psystems, double dt,
+							const TimestepLimits & limits, double ballSpeed);
 void cleanupParticleSystems(std::vector<ParticleSystem*> & psystems);
+// The per-system pieces of the functions above, for callers that schedule systems themselves.
+// stepParticleSystem advances one system the way the adaptive update does
+void stepParticleSystem(ParticleSystem* ps, double dt, const TimestepLimits & limits, double ballSpeed);
+// Deletes the systems that are done and closes the gaps, keeping the order
+void removeDoneParticleSystems(std::vector<ParticleSystem*> & psystems);
+void snapshotParticleSystems(const std::vector<ParticleSystem*> & psystems, FrameSnapshot & frame);
 
 
 // Interface for the Spring-Mass based Particle System
@@ -91,6 +325,11 @@ protected:
 		Particle* particle1;
 		Particle* particle2;
 
+		// Positions of the two linked particles in the particles list
+		// (filled in by rebuildAdjacency)
+		int index1;
+		int index2;
+
 		// Strength of the connection
 		double stiffness;	
 		
@@ -111,18 +350,219 @@ protected:
 	};
 
 public:
+	// Orderings reorder() can put the particles in. A grid straight from init()
+	// is already in a good order (average spring span about 3/4 of the grid size),
+	// so strands built that way are best left alone or given Morton
+	enum ReorderMethod
+	{
+		REORDER_NONE,
+		// Along a Morton (Z-order) curve through the particle positions. Slightly
+		// shorter springs on average than init()'s order, as long as particles
+		// linked by springs are also close in space
+		REORDER_MORTON,
+		// Reverse Cuthill-McKee on the spring graph, keeps every spring within
+		// about twice the grid size whatever the positions. Longer on average than
+		// the other two on an init() grid, it pays off once the order is scrambled
+		// and the positions no longer follow the springs (tangled strands)
+		REORDER_RCM
+	};
+
+	// Compressed sparse row (CSR) view of the spring network.
+	// The springs touching particle i are springs[offsets[i]] .. springs[offsets[i+1] - 1],
+	// neighbors holds the particle on the other end and signs is +1 if particle i
+	// is the spring's particle2 (it receives calculateSpringForce()) or -1 otherwise
+	struct SpringAdjacency
+	{
+		std::vector<int> offsets;
+		std::vector<int> springs;
+		std::vector<int> neighbors;
+		std::vector<double> signs;
+	};
+
+	// How integrate() moves the particles
+	enum Integrator
+	{
+		// Symplectic Euler on the forces from applyForces, stable only for
+		// steps below the spring limits in stableTimestep
+		INTEGRATE_EXPLICIT,
+		// Backward Euler on the springs, stable at any step but each step is a
+		// linear solve (see SpringSolver)
+		INTEGRATE_IMPLICIT
+	};
+
+	// How closely a system is simulated, see setDetail()
+	enum Detail
+	{
+		DETAIL_FULL,
+		// One implicit step every reducedInterval frames, the particles are
+		// moved there in equal parts over the frames of the interval
+		DETAIL_REDUCED
+	};
+
+	// Everything spawn() needs to build one system
+	struct SpawnParams
+	{
+		Vector3 location;
+		int gridSize;
+		ReorderMethod reorderMethod;
+
+		SpawnParams(const Vector3 & location = Vector3(), int gridSize = 10,
+					ReorderMethod reorderMethod = REORDER_NONE)
+			: location(location), gridSize(gridSize), reorderMethod(reorderMethod)
+		{}
+	};
+
     // Tracks all spring connections in the particle system
 	std::vector<SpringJoint> springConnections;	
+
+	// When true spring forces are gathered per particle through the adjacency,
+	// otherwise each spring scatters its force onto both of its particles.
+	// Off by default: gathering only pays once the per-particle loop runs in
+	// parallel, run serially it is slower than scattering (BM_SpringMassUpdate)
+	bool gatherForces;
+
+	// Particles per side of the grid built by init()
+	int gridSize;
+
+	// Ordering applied by init() and, every reorderInterval steps (0 = never), by update()
+	ReorderMethod reorderMethod;
+	int reorderInterval;
+
+	Integrator integrator;
+
+	// Solves the implicit steps, its preconditioner and tolerance can be changed at any time
+	SpringSolver solver;
+
+	// Frames (calls to update or to the three pieces of it) per step at reduced detail
+	int reducedInterval;
 	
-	ParticleSystemSpringMass(const Vector3 & startingLocation = Vector3());
+
+	ParticleSystemSpringMass(const Vector3 & startingLocation = Vector3(), int gridSize = 10,
+								ReorderMethod reorderMethod = REORDER_NONE);
 	virtual ~ParticleSystemSpringMass();
+
+	// Builds one system per entry of params and appends them all to psystems at once.
+	// The particles of every system share a single ParticleBlock and the systems
+	// are built on up to threads threads (0 = one per hardware thread)
+	static void spawn(const std::vector<SpawnParams> & params,
+						std::vector<ParticleSystem*> & psystems, int threads = 0);
 	
 	// Extended functions from the base class Particle System
 	virtual void init();
-	virtual void update(double dt);
+	virtual void applyForces(double dt);
+	virtual void resolveCollisions();
+	virtual void integrate(double dt);
 	virtual void render() const;
+	virtual void snapshot(FrameSnapshot & frame);
+	virtual double stableTimestep(const TimestepLimits & limits, double ballSpeed) const;
 	virtual void cleanup();
 	virtual bool isDone() const;
+
+	// Recomputes spring indices and the CSR adjacency, call after adding or
+	// removing particles or springs
+	void rebuildAdjacency();
+
+	// Switches between full and reduced detail. The particles always hold the
+	// state being shown, so either switch continues from exactly what was on
+	// screen; a system promoted mid interval carries on from the in-between state
+	void setDetail(Detail d);
+	Detail detail() const { return currentDetail; }
+
+	// The current CSR adjacency of the spring network
+	const SpringAdjacency & adjacency() const { return springAdjacency; }
+
+	// Renumbers the particles in the given order and sorts the springs by their
+	// first particle so a pass over the springs walks memory mostly forwards.
+	// The particle objects stay where they are, their contents are permuted
+	void reorder(ReorderMethod method);
+
+	// Same as above with an explicit order, order[new index] = old index
+	void reorder(const std::vector<int> & order);
+
+	// Average distance in the particles list between the two ends of a spring,
+	// a proxy for how many cache lines a pass over the springs touches
+	double springSpan() const;
+
+protected:
+	// Used by spawn(), builds the grid into storage instead of allocating each particle
+	ParticleSystemSpringMass(const SpawnParams & params, Particle* storage);
+
+	// Builds the grid from init(), placing the particles in storage when it isn't NULL
+	void initGrid(Particle* storage);
+
+	SpringAdjacency springAdjacency;
+
+	// Cell of the init() grid each particle was built in, row * gridSize + column,
+	// in the same order as particles. The solver coarsens along this grid
+	std::vector<int> gridCells;
+
+	// Set by rebuildAdjacency, the solver is rebuilt before the next implicit step
+	bool solverStale;
+
+	// The springs by the dirty tracking chunk of their lower end, chunk c's are
+	// chunkSprings[chunkSpringOffsets[c]] .. chunkSprings[chunkSpringOffsets[c+1] - 1]
+	std::vector<int> chunkSprings;
+	std::vector<int> chunkSpringOffsets;
+
+	// Scratch space of the implicit step
+	std::vector<Vector3> implicitRhs;
+	std::vector<Vector3> implicitDv;
+	std::vector<char> implicitLocked;
+
+	Detail currentDetail;
+	// Frames into the current reduced interval, the step is taken at frame 0
+	int reducedFrame;
+	// How far each particle moves per frame of the current reduced interval,
+	// and where it ends up
+	std::vector<Vector3> reducedStep;
+	std::vector<Vector3> reducedEnd;
+
+	// One step of dt with the given integrator, what integrate() does at full detail
+	// (with track set, see ParticleSystem::advance)
+	void integrateWith(double dt, Integrator method, bool track);
+
+	// Scratch space for the gather path, the force of each spring on its particle2
+	// (sized by rebuildAdjacency)
+	std::vector<Vector3> springForces;
+
+	// Largest per-particle sums of stiffness / mass and damping / mass over the
+	// attached springs, the stiff limits for stableTimestep (set by rebuildAdjacency)
+	double maxStiffnessRate;
+	double maxDampingRate;
+
+	// Steps taken since the last reorder
+	int stepsSinceReorder;
+
+	// The two halves of the gather path, kept separate so each stays a plain loop
+	void computeSpringForces();
+	void gatherSpringForces();
 };
 
+// The two per-spring and per-particle force kernels are defined here so they
+// inline into the update loops
+
+inline void Particle::applyForce(const Vector3 & force)
+{
+	acc += (force / mass);
+}
+
+// Spring Joint function to calculate force
+inline Vector3 ParticleSystemSpringMass::SpringJoint::calculateSpringForce() const
+{
+	double kd = this->damp;
+	double ks = this->stiffness;
+	const Vector3 & p1 = particle1->pos;
+	const Vector3 & p2 = particle2->pos;
+	const Vector3 & v1 = particle1->vel;
+	const Vector3 & v2 = particle2->vel;
+
+	Vector3 x = p2-p1;
+	Vector3 b = v2-v1;
+	
+	Vector3 fspring = x * ks * -1.0;
+	Vector3 fdamp = b * kd * -1.0;
+	Vector3 f = fspring + fdamp;
+	return f;
+}
+
 #endif
@@ -0,0 +1,137 @@
+#ifndef __PLAYER_H__
+#define __PLAYER_H__
+
+#include <GL/glut.h>
+#include <cmath>
+
+#include "const.h"
+#include "color.h"
+#include "vector3.h"
+
+const float globalDrag = 0.999;
+
+//controls ball
+class Player
+{
+public:
+    float r, m;
+    bool rotate, isPlayer;
+    Vector3 pos, vel, acc;
+    Color4 col;
+    
+    void update(int time)
+    {
+        //controls rotation of ball, time is in milliseconds
+        if(rotate)
+        {
+            float rot_x = sin(time/4.0 * FRAME_DT) * 300.0;
+            float rot_y = cos(time/4.0 * FRAME_DT) * 300.0;  
+          
+            //sets velocity of ball as rotation 
+            vel = Vector3(rot_x, rot_y, 0.0);
+        }
+
+    	if(pos.x + r >= WINDOW_WIDTH || pos.x - r <= 0.0)
+     	   vel.x *= -1;
+
+    	if(pos.y + r >= WINDOW_HEIGHT || pos.y - r <= 0.0)
+     	   vel.y *= -1;
+     	
+     	//velocity of ball is affected by the global drag force
+    	vel *= globalDrag;
+    	pos += vel * FRAME_DT;
+	}
+	Player()
+	{
+	    pos = Vector3(WINDOW_WIDTH / 2.0, WINDOW_HEIGHT / 2.0, 0.0);
+        vel = Vector3(0.0, 0.0, 0.0);
+        acc = Vector3(0.0, 0.0, 0.0);
+	    r = 40.0;
+	    m = 40.0;
+	    rotate = false;
+	    isPlayer = false;
+	    col = Color4(1.0, 0.0, 0.0, 1.0);
+	}
+	Player(Vector3 center, float size, float mass)
+	{
+	    pos = center;
+        vel = Vector3(0.0, 0.0, 0.0);
+        acc = Vector3(0.0, 0.0, 0.0);
+	    r = size;
+	    m = mass;
+	    rotate = false;
+	    isPlayer = false;
+	    col = Color4(1.0, 0.0, 0.0, 1.0);
+	}
+	void render()
+	{
+	    glPushMatrix();
+        glColor3f(col.r, col.g, col.b);
+        glTranslatef(pos.x, pos.y, pos.z);
+        glutSolidSphere(this->r, 80.0, 80.0);
+        glPopMatrix();
+    }
+    float volume()
+    {
+        return (4.0/3.0) * PI * r*r*r;
+    }
+    float perimeter()
+    {
+        return 2.0 * PI * r;
+    }
+    float area()
+    {
+        return 4.0 * PI * r;
+    }
+    bool isInside(const Vector3& p) const
+    {
+        Vector3 temp = this->pos - p;
+        double distance = temp.x*temp.x + temp.y*temp.y + temp.z*temp.z;
+        if(distance <= r*r)
+            return true;
+        return false;
+    }
+    bool lineCollision(const Vector3& p1, const Vector3& p2) const
+    {
+        //distance direction vector
+        Vector3 d = p2 - p1;
+        
+        //vector from first point of line to center of sphere
+        Vector3 f = p1 - pos;
+        
+        //calculate using pythagorean formula
+        float a = d.dot(d);
+        float b = 2.0 * f.dot(d);
+        float c = f.dot(f) - r*r;
+        
+        float check = (b * b) - (4.0 * a * c);
+        
+        //no collision
+        if(check < 0.0)
+            return false;
+        
+        //there may be a collision
+        else
+        {
+            //apply pythagorean formula
+            check = sqrt(check);
+            float t1 = (-1.0 * b - check) / (2.0 * a);
+            float t2 = (-1.0 * b + check) / (2.0 * a);
+            
+            //check if point is within sphere
+            if(t1 >= 0.0 && t1 <= 1.0)
+                return true;
+            if(t2 >= 0.0 && t2 <= 1.0)
+                return true;
+            return false;
+        }
+        
+        return false;
+    }
+    void rotation(bool trigger)
+    {
+        rotate = trigger;
+    }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "snapshot.h"
+
+void DirtyRegion::expand(const DirtyRegion & r)
+{
+	box.expand(r.box);
+	moved += r.moved;
+}
+
+/////////////////////////////////////
+/// FrameSnapshot Implementation ///
+/////////////////////////////////////
+
+FrameSnapshot::FrameSnapshot()
+	: frame(0), particles(), springs(), balls(), chunks()
+{
+}
+
+void FrameSnapshot::clear()
+{
+	particles.clear();
+	springs.clear();
+	balls.clear();
+	chunks.clear();
+}
+
+//////////////////////////////////////
+/// SnapshotBuffer Implementation ///
+//////////////////////////////////////
+
+SnapshotBuffer::SnapshotBuffer()
+	: middle(1), back(0), front(2)
+{
+}
+
+FrameSnapshot & SnapshotBuffer::backBuffer()
+{
+	return buffers[back];
+}
+
+void SnapshotBuffer::publish()
+{
+	// Hand the finished frame over and take whatever was in the middle as the
+	// new back buffer (either an old frame or one the consumer skipped)
+	int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+	back = previous & ~FRESH;
+}
+
+bool SnapshotBuffer::hasNewFrame() const
+{
+	return (middle.load(std::memory_order_acquire) & FRESH) != 0;
+}
+
+const FrameSnapshot & SnapshotBuffer::acquire()
+{
+	if (hasNewFrame())
+	{
+		int previous = middle.exchange(front, std::memory_order_acq_rel);
+		front = previous & ~FRESH;
+	}
+	return buffers[front];
+}
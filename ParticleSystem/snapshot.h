@@ -0,0 +1,124 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "vector3.h"
+#include "color.h"
+#include "particlelook.h"
+#include "collider.h"
+
+#include <vector>
+#include <atomic>
+
+// Read-only copy of a particle that a renderer (or any other consumer) needs
+struct ParticleSnapshot
+{
+	Vector3 pos;
+	ParticleLook look;
+};
+
+// A spring is stored as two indices into FrameSnapshot::particles
+struct SpringSnapshot
+{
+	int particle1;
+	int particle2;
+};
+
+// A ball (Player) as seen by the renderer
+struct BallSnapshot
+{
+	Vector3 pos;
+	double r;
+	Color4 col;
+};
+
+// What moved in a set of particles: how many of them did, and the box around
+// where they were and where they are now
+struct DirtyRegion
+{
+	Aabb box;
+	int moved;
+
+	DirtyRegion()
+		: box(), moved(0)
+	{}
+	bool isClean() const { return moved == 0; }
+	void expand(const DirtyRegion & r);
+};
+
+// A run of particles of one system and the springs drawn with them, the unit a
+// consumer can skip when nothing in it changed
+struct ChunkSnapshot
+{
+	// Together they name the chunk from one frame to the next
+	unsigned system;
+	int chunk;
+
+	// Stays the same for as long as the particles and springs of the chunk do
+	// (see ParticleSystem::chunkVersion), so a consumer that kept what it made of
+	// the chunk last time can reuse it even if it missed the frames in between.
+	// Positions only count as changed once they moved motionThreshold from where
+	// they were last counted, so what is reused may be up to twice that away
+	// from the positions in the frame, which are exact
+	unsigned version;
+
+	// Motion of its own particles since the system's last clearDirty(), which
+	// the simulation calls after publishing each frame
+	DirtyRegion dirty;
+
+	int firstParticle;
+	int particleCount;
+	int firstSpring;
+	int springCount;
+};
+
+// Everything needed to draw one simulation step without touching the
+// live particle systems
+struct FrameSnapshot
+{
+	int frame;
+	std::vector<ParticleSnapshot> particles;
+	std::vector<SpringSnapshot> springs;
+	std::vector<BallSnapshot> balls;
+	// Every particle and spring belongs to exactly one chunk
+	std::vector<ChunkSnapshot> chunks;
+
+	FrameSnapshot();
+
+	// Empties the lists but keeps their storage so the next step doesn't reallocate
+	void clear();
+};
+
+// Lock-free hand-off of frames between one producer (the simulation) and one
+// consumer (the renderer). Three buffers are used so that neither side ever
+// waits: the producer fills the back buffer, the consumer reads the front
+// buffer, and the middle one holds the newest finished frame. Swaps are a
+// single atomic exchange of the middle index.
+class SnapshotBuffer
+{
+public:
+	SnapshotBuffer();
+
+	// Producer side: the buffer to write step N+1 into
+	FrameSnapshot & backBuffer();
+
+	// Producer side: makes the back buffer the newest frame and takes a fresh back buffer
+	void publish();
+
+	// Consumer side: true if a frame has been published since the last acquire()
+	bool hasNewFrame() const;
+
+	// Consumer side: returns the newest published frame. The reference stays
+	// valid and unchanged until the next call to acquire()
+	const FrameSnapshot & acquire();
+
+private:
+	// Bit set in 'middle' when it holds a frame the consumer hasn't seen yet
+	static const int FRESH = 4;
+
+	FrameSnapshot buffers[3];
+	std::atomic<int> middle;
+	int back;
+	int front;
+};
+
+#endif
@@ -0,0 +1,560 @@
+#include "springsolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Levels this small are solved directly instead of coarsened further
+static const int MAX_DIRECT = 64;
+
+///////////////////////////////////
+/// SparseMatrix Implementation ///
+///////////////////////////////////
+
+SpringSolver::SparseMatrix::SparseMatrix()
+	: rows(0), cols(0), channels(1), offsets(1, 0), columns(), values()
+{
+}
+
+// Row by row product (Gustavson). The result has as many channels as the wider
+// operand, a single channel operand multiplies every channel of the other
+SpringSolver::SparseMatrix SpringSolver::multiply(const SparseMatrix & a, const SparseMatrix & b)
+{
+	SparseMatrix c;
+	c.rows = a.rows;
+	c.cols = b.cols;
+	c.channels = std::max(a.channels, b.channels);
+	c.offsets.assign(a.rows + 1, 0);
+
+	// Where column j of the current row is in c, or below the row's start if not yet there
+	std::vector<int> position(b.cols, -1);
+	for (int i = 0; i < a.rows; ++i)
+	{
+		const int rowStart = c.columns.size();
+		for (int ka = a.offsets[i]; ka < a.offsets[i + 1]; ++ka)
+		{
+			int j = a.columns[ka];
+			for (int kb = b.offsets[j]; kb < b.offsets[j + 1]; ++kb)
+			{
+				int col = b.columns[kb];
+				if (position[col] < rowStart)
+				{
+					position[col] = c.columns.size();
+					c.columns.push_back(col);
+					c.values.resize(c.values.size() + c.channels, 0.0);
+				}
+				for (int ch = 0; ch < c.channels; ++ch)
+					c.values[position[col] * c.channels + ch] += a.value(ka, ch) * b.value(kb, ch);
+			}
+		}
+		c.offsets[i + 1] = c.columns.size();
+	}
+	return c;
+}
+
+SpringSolver::SparseMatrix SpringSolver::transpose(const SparseMatrix & a)
+{
+	SparseMatrix t;
+	t.rows = a.cols;
+	t.cols = a.rows;
+	t.channels = a.channels;
+	t.offsets.assign(a.cols + 1, 0);
+	for (int k = 0; k < a.columns.size(); ++k)
+		++t.offsets[a.columns[k] + 1];
+	for (int i = 0; i < a.cols; ++i)
+		t.offsets[i + 1] += t.offsets[i];
+
+	std::vector<int> next(t.offsets.begin(), t.offsets.end() - 1);
+	t.columns.resize(a.columns.size());
+	t.values.resize(a.values.size());
+	for (int i = 0; i < a.rows; ++i)
+	{
+		for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+		{
+			int dst = next[a.columns[k]]++;
+			t.columns[dst] = i;
+			for (int ch = 0; ch < a.channels; ++ch)
+				t.values[dst * a.channels + ch] = a.values[k * a.channels + ch];
+		}
+	}
+	return t;
+}
+
+// The coarse points along one axis of n fine points that fine point i takes its
+// value from. Even points sit on a coarse point, odd ones halfway between two,
+// except a last odd point which copies its only coarse neighbour
+static int interpolationWeights(int i, int n, int * coarse, double * weight)
+{
+	if (i % 2 == 0)
+	{
+		coarse[0] = i / 2;
+		weight[0] = 1.0;
+		return 1;
+	}
+	if ((i + 1) / 2 < (n + 1) / 2)
+	{
+		coarse[0] = (i - 1) / 2;
+		coarse[1] = (i + 1) / 2;
+		weight[0] = 0.5;
+		weight[1] = 0.5;
+		return 2;
+	}
+	coarse[0] = (i - 1) / 2;
+	weight[0] = 1.0;
+	return 1;
+}
+
+SpringSolver::SparseMatrix SpringSolver::gridProlongation(int rows, int cols, const std::vector<int> & fineIndex)
+{
+	const int coarseCols = (cols + 1) / 2;
+	SparseMatrix p;
+	p.rows = rows * cols;
+	p.cols = ((rows + 1) / 2) * coarseCols;
+	p.offsets.assign(p.rows + 1, 0);
+
+	int rowCoarse[2], colCoarse[2];
+	double rowWeight[2], colWeight[2];
+	for (int i = 0; i < rows; ++i)
+	{
+		int nr = interpolationWeights(i, rows, rowCoarse, rowWeight);
+		for (int j = 0; j < cols; ++j)
+			p.offsets[fineIndex[i * cols + j] + 1] = nr * interpolationWeights(j, cols, colCoarse, colWeight);
+	}
+	for (int i = 0; i < p.rows; ++i)
+		p.offsets[i + 1] += p.offsets[i];
+
+	p.columns.resize(p.offsets.back());
+	p.values.resize(p.offsets.back());
+	for (int i = 0; i < rows; ++i)
+	{
+		int nr = interpolationWeights(i, rows, rowCoarse, rowWeight);
+		for (int j = 0; j < cols; ++j)
+		{
+			int nc = interpolationWeights(j, cols, colCoarse, colWeight);
+			int k = p.offsets[fineIndex[i * cols + j]];
+			for (int a = 0; a < nr; ++a)
+			{
+				for (int b = 0; b < nc; ++b, ++k)
+				{
+					p.columns[k] = rowCoarse[a] * coarseCols + colCoarse[b];
+					p.values[k] = rowWeight[a] * colWeight[b];
+				}
+			}
+		}
+	}
+	return p;
+}
+
+///////////////////////////////////
+/// SpringSolver Implementation ///
+///////////////////////////////////
+
+SpringSolver::SpringSolver()
+	: preconditioner(PRECONDITION_MULTIGRID), tolerance(1e-5), maxIterations(500), smoothingSweeps(1),
+	  maxDirectSize(4096), maxDirectBandwidth(64), hierarchy(), coarseFactor(), combinedH(-1.0),
+	  bandwidth(0), bandFactor(), factoredH(-1.0), factoredLocked(), r(), z(), p(), q(), iterations(0), residual(0.0)
+{
+}
+
+void SpringSolver::build(const std::vector<double> & masses, const std::vector<SolverSpring> & springs,
+							const std::vector<int> & gridCells, int gridRows, int gridCols)
+{
+	const int n = masses.size();
+	hierarchy.assign(1, Level());
+	coarseFactor.clear();
+	combinedH = -1.0;
+	bandFactor.clear();
+	factoredH = -1.0;
+
+	// Level 0 is the springs' own matrix, one row per particle with the diagonal first.
+	// Two springs between the same particles just make two entries
+	SparseMatrix & a = hierarchy[0].parts;
+	a.rows = n;
+	a.cols = n;
+	a.channels = 3;
+	a.offsets.assign(n + 1, 0);
+	for (int i = 0; i < n; ++i)
+		a.offsets[i + 1] = 1;
+	for (int s = 0; s < springs.size(); ++s)
+	{
+		if (springs[s].i == springs[s].j)
+			continue;
+		++a.offsets[springs[s].i + 1];
+		++a.offsets[springs[s].j + 1];
+	}
+	for (int i = 0; i < n; ++i)
+		a.offsets[i + 1] += a.offsets[i];
+
+	a.columns.resize(a.offsets.back());
+	a.values.assign(3 * a.offsets.back(), 0.0);
+	std::vector<int> next(a.offsets.begin(), a.offsets.end() - 1);
+	for (int i = 0; i < n; ++i)
+	{
+		int k = next[i]++;
+		a.columns[k] = i;
+		a.values[3 * k] = masses[i];
+	}
+	for (int s = 0; s < springs.size(); ++s)
+	{
+		const SolverSpring & sp = springs[s];
+		if (sp.i == sp.j)
+			continue;
+		int ends[2] = { sp.i, sp.j };
+		for (int e = 0; e < 2; ++e)
+		{
+			int row = ends[e];
+			int k = next[row]++;
+			a.columns[k] = ends[1 - e];
+			a.values[3 * k + 1] = -sp.damping;
+			a.values[3 * k + 2] = -sp.stiffness;
+			int d = a.offsets[row];
+			a.values[3 * d + 1] += sp.damping;
+			a.values[3 * d + 2] += sp.stiffness;
+		}
+	}
+
+	bandwidth = 0;
+	for (int i = 0; i < n; ++i)
+		for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+			bandwidth = std::max(bandwidth, std::abs(a.columns[k] - i));
+
+	r.resize(n);
+	z.resize(n);
+	p.resize(n);
+	q.resize(n);
+
+	// The hierarchy needs every cell of the grid to hold exactly one particle
+	bool grid = gridRows > 0 && gridCols > 0 && gridCells.size() == n && gridRows * gridCols == n;
+	std::vector<int> fineIndex(grid ? n : 0, -1);
+	for (int i = 0; i < n && grid; ++i)
+	{
+		grid = gridCells[i] >= 0 && gridCells[i] < n && fineIndex[gridCells[i]] < 0;
+		if (grid)
+			fineIndex[gridCells[i]] = i;
+	}
+	if (!grid)
+	{
+		hierarchy[0].gridRows = 0;
+		hierarchy[0].gridCols = 0;
+		return;
+	}
+
+	hierarchy[0].gridRows = gridRows;
+	hierarchy[0].gridCols = gridCols;
+	while (hierarchy.back().parts.rows > MAX_DIRECT)
+	{
+		Level & fine = hierarchy.back();
+		fine.prolongation = gridProlongation(fine.gridRows, fine.gridCols, fineIndex);
+		fine.restriction = transpose(fine.prolongation);
+
+		// Galerkin coarse matrix P^T A P, done per part so it stays a function of h
+		Level coarse;
+		coarse.parts = multiply(fine.restriction, multiply(fine.parts, fine.prolongation));
+		coarse.gridRows = (fine.gridRows + 1) / 2;
+		coarse.gridCols = (fine.gridCols + 1) / 2;
+		hierarchy.push_back(coarse);
+
+		// Coarse levels are numbered row by row
+		fineIndex.resize(coarse.parts.rows);
+		for (int i = 0; i < fineIndex.size(); ++i)
+			fineIndex[i] = i;
+	}
+	for (int l = 0; l < hierarchy.size(); ++l)
+	{
+		Level & level = hierarchy[l];
+		level.x.resize(level.parts.rows);
+		level.b.resize(level.parts.rows);
+		level.r.resize(level.parts.rows);
+	}
+}
+
+// Sets every level's matrix to M + h D + h^2 K and refactors the coarsest one
+void SpringSolver::combine(double h)
+{
+	combinedH = h;
+	for (int l = 0; l < hierarchy.size(); ++l)
+	{
+		Level & level = hierarchy[l];
+		const SparseMatrix & a = level.parts;
+		level.matrix.resize(a.columns.size());
+		level.diagonal.assign(a.rows, 0.0);
+		for (int i = 0; i < a.rows; ++i)
+		{
+			for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+			{
+				level.matrix[k] = a.values[3 * k] + h * a.values[3 * k + 1] + h * h * a.values[3 * k + 2];
+				if (a.columns[k] == i)
+					level.diagonal[i] += level.matrix[k];
+			}
+		}
+	}
+
+	if (hierarchy[0].gridRows == 0)
+		return;
+
+	// Dense Cholesky, L is stored in the lower triangle
+	const Level & last = hierarchy.back();
+	const int n = last.parts.rows;
+	std::vector<double> & c = coarseFactor;
+	c.assign(n * n, 0.0);
+	for (int i = 0; i < n; ++i)
+		for (int k = last.parts.offsets[i]; k < last.parts.offsets[i + 1]; ++k)
+			c[i * n + last.parts.columns[k]] += last.matrix[k];
+	for (int j = 0; j < n; ++j)
+	{
+		double d = c[j * n + j];
+		for (int k = 0; k < j; ++k)
+			d -= c[j * n + k] * c[j * n + k];
+		c[j * n + j] = std::sqrt(std::max(d, 1e-300));
+		for (int i = j + 1; i < n; ++i)
+		{
+			double s = c[i * n + j];
+			for (int k = 0; k < j; ++k)
+				s -= c[i * n + k] * c[j * n + k];
+			c[i * n + j] = s / c[j * n + j];
+		}
+	}
+}
+
+void SpringSolver::multiply(const Level & level, const std::vector<Vector3> & x, std::vector<Vector3> & y) const
+{
+	const SparseMatrix & a = level.parts;
+	for (int i = 0; i < a.rows; ++i)
+	{
+		Vector3 sum;
+		for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+			sum.addScaled(x[a.columns[k]], level.matrix[k]);
+		y[i] = sum;
+	}
+}
+
+// One Gauss-Seidel sweep over level.x, a backward sweep after a forward one
+// keeps the V-cycle symmetric as conjugate gradient needs
+void SpringSolver::smooth(Level & level, bool forward)
+{
+	const SparseMatrix & a = level.parts;
+	const int n = a.rows;
+	for (int step = 0; step < n; ++step)
+	{
+		int i = forward ? step : n - 1 - step;
+		Vector3 sum;
+		for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+			sum.addScaled(level.x[a.columns[k]], level.matrix[k]);
+		level.x[i].addScaled(level.b[i] - sum, 1.0 / level.diagonal[i]);
+	}
+}
+
+// Approximately solves level l for its b into its x, starting from zero
+void SpringSolver::vcycle(int l)
+{
+	Level & level = hierarchy[l];
+	const int n = level.parts.rows;
+
+	if (l + 1 == hierarchy.size())
+	{
+		// Forward then back substitution with the Cholesky factor
+		const std::vector<double> & c = coarseFactor;
+		for (int i = 0; i < n; ++i)
+		{
+			Vector3 s = level.b[i];
+			for (int k = 0; k < i; ++k)
+				s.addScaled(level.x[k], -c[i * n + k]);
+			level.x[i] = s / c[i * n + i];
+		}
+		for (int i = n - 1; i >= 0; --i)
+		{
+			Vector3 s = level.x[i];
+			for (int k = i + 1; k < n; ++k)
+				s.addScaled(level.x[k], -c[k * n + i]);
+			level.x[i] = s / c[i * n + i];
+		}
+		return;
+	}
+
+	std::fill(level.x.begin(), level.x.end(), Vector3());
+	for (int s = 0; s < smoothingSweeps; ++s)
+		smooth(level, true);
+
+	// Hand the remaining error to the coarser level and add its correction back
+	multiply(level, level.x, level.r);
+	for (int i = 0; i < n; ++i)
+		level.r[i] = level.b[i] - level.r[i];
+	Level & coarse = hierarchy[l + 1];
+	const SparseMatrix & toCoarse = level.restriction;
+	for (int i = 0; i < toCoarse.rows; ++i)
+	{
+		Vector3 sum;
+		for (int k = toCoarse.offsets[i]; k < toCoarse.offsets[i + 1]; ++k)
+			sum.addScaled(level.r[toCoarse.columns[k]], toCoarse.values[k]);
+		coarse.b[i] = sum;
+	}
+
+	vcycle(l + 1);
+
+	const SparseMatrix & fromCoarse = level.prolongation;
+	for (int i = 0; i < n; ++i)
+		for (int k = fromCoarse.offsets[i]; k < fromCoarse.offsets[i + 1]; ++k)
+			level.x[i].addScaled(coarse.x[fromCoarse.columns[k]], fromCoarse.values[k]);
+
+	for (int s = 0; s < smoothingSweeps; ++s)
+		smooth(level, false);
+}
+
+void SpringSolver::precondition(const std::vector<Vector3> & r, const std::vector<char> & locked, std::vector<Vector3> & z)
+{
+	const int n = r.size();
+	if (preconditioner == PRECONDITION_MULTIGRID && hierarchy[0].gridRows > 0)
+	{
+		Level & top = hierarchy[0];
+		top.b = r;
+		vcycle(0);
+		for (int i = 0; i < n; ++i)
+			z[i] = locked[i] ? Vector3() : top.x[i];
+	}
+	else
+	{
+		const std::vector<double> & d = hierarchy[0].diagonal;
+		for (int i = 0; i < n; ++i)
+			z[i] = locked[i] ? Vector3() : r[i] / d[i];
+	}
+}
+
+// Factors level 0 with the rows and columns of the locked particles replaced by
+// their diagonal, which makes their dv come out 0 and leaves the others alone
+void SpringSolver::factorBanded(const std::vector<char> & locked)
+{
+	const Level & level = hierarchy[0];
+	const SparseMatrix & a = level.parts;
+	const int n = a.rows;
+	const int w = bandwidth + 1;
+	std::vector<double> & l = bandFactor;
+	l.assign(n * w, 0.0);
+
+	// Entry (i, j) with j <= i is at l[i * w + j - i + bandwidth]
+	for (int i = 0; i < n; ++i)
+	{
+		for (int k = a.offsets[i]; k < a.offsets[i + 1]; ++k)
+		{
+			int j = a.columns[k];
+			if (j <= i && (j == i || (!locked[i] && !locked[j])))
+				l[i * w + j - i + bandwidth] += level.matrix[k];
+		}
+	}
+
+	for (int i = 0; i < n; ++i)
+	{
+		for (int j = std::max(0, i - bandwidth); j <= i; ++j)
+		{
+			double s = l[i * w + j - i + bandwidth];
+			for (int k = std::max(0, i - bandwidth); k < j; ++k)
+				s -= l[i * w + k - i + bandwidth] * l[j * w + k - j + bandwidth];
+			if (j == i)
+				l[i * w + bandwidth] = std::sqrt(std::max(s, 1e-300));
+			else
+				l[i * w + j - i + bandwidth] = s / l[j * w + bandwidth];
+		}
+	}
+	factoredH = combinedH;
+	factoredLocked = locked;
+}
+
+void SpringSolver::solveBanded(const std::vector<Vector3> & b, std::vector<Vector3> & x) const
+{
+	const int n = b.size();
+	const int w = bandwidth + 1;
+
+	// L y = b, then L^T x = y a row of L at a time so both passes read L in order
+	for (int i = 0; i < n; ++i)
+	{
+		const double * row = &bandFactor[i * w + bandwidth];
+		Vector3 s = b[i];
+		for (int k = std::max(0, i - bandwidth); k < i; ++k)
+			s.addScaled(x[k], -row[k - i]);
+		x[i] = s / row[0];
+	}
+	for (int i = n - 1; i >= 0; --i)
+	{
+		const double * row = &bandFactor[i * w + bandwidth];
+		x[i] /= row[0];
+		for (int k = std::max(0, i - bandwidth); k < i; ++k)
+			x[k].addScaled(x[i], -row[k - i]);
+	}
+}
+
+// Preconditioned conjugate gradient on the free particles: the locked ones are
+// zeroed out of every vector, which solves the system with their rows and
+// columns removed without rebuilding anything when they change
+int SpringSolver::solve(double h, const std::vector<Vector3> & b, const std::vector<char> & locked,
+						std::vector<Vector3> & dv)
+{
+	const int n = b.size();
+	dv.assign(n, Vector3());
+	iterations = 0;
+	residual = 0.0;
+	if (n == 0)
+		return 0;
+	if (h != combinedH)
+		combine(h);
+
+	if (n <= maxDirectSize && bandwidth <= maxDirectBandwidth)
+	{
+		if (factoredH != h || factoredLocked != locked)
+			factorBanded(locked);
+		for (int i = 0; i < n; ++i)
+			r[i] = locked[i] ? Vector3() : b[i];
+		solveBanded(r, dv);
+		return 0;
+	}
+
+	double bb = 0.0;
+	for (int i = 0; i < n; ++i)
+	{
+		r[i] = locked[i] ? Vector3() : b[i];
+		bb += r[i].dot(r[i]);
+	}
+	if (bb == 0.0)
+		return 0;
+
+	precondition(r, locked, z);
+	p = z;
+	double rz = 0.0;
+	for (int i = 0; i < n; ++i)
+		rz += r[i].dot(z[i]);
+
+	double rr = bb;
+	const double target = tolerance * tolerance * bb;
+	while (iterations < maxIterations && rr > target)
+	{
+		multiply(hierarchy[0], p, q);
+		double pq = 0.0;
+		for (int i = 0; i < n; ++i)
+		{
+			if (locked[i])
+				q[i] = Vector3();
+			pq += p[i].dot(q[i]);
+		}
+		double alpha = rz / pq;
+
+		rr = 0.0;
+		for (int i = 0; i < n; ++i)
+		{
+			dv[i].addScaled(p[i], alpha);
+			r[i].addScaled(q[i], -alpha);
+			rr += r[i].dot(r[i]);
+		}
+		++iterations;
+		if (rr <= target)
+			break;
+
+		precondition(r, locked, z);
+		double rzNext = 0.0;
+		for (int i = 0; i < n; ++i)
+			rzNext += r[i].dot(z[i]);
+		double beta = rzNext / rz;
+		rz = rzNext;
+		for (int i = 0; i < n; ++i)
+			p[i] = z[i] + p[i] * beta;
+	}
+	residual = std::sqrt(rr / bb);
+	return iterations;
+}
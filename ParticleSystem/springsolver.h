@@ -0,0 +1,155 @@
+#ifndef __SPRINGSOLVER_H__
+#define __SPRINGSOLVER_H__
+
+#include "vector3.h"
+
+#include <vector>
+
+// A spring between particles i and j as the solver sees it
+struct SolverSpring
+{
+	int i;
+	int j;
+	double stiffness;
+	double damping;
+
+	SolverSpring(int i, int j, double stiffness, double damping)
+		: i(i), j(j), stiffness(stiffness), damping(damping)
+	{}
+};
+
+// Solves the linear system of an implicit (backward Euler) step of a spring network,
+//
+//     (M + h D + h^2 K) dv = b
+//
+// where M holds the masses and D and K are the graph Laplacians of the springs'
+// damping and stiffness. Springs pull their ends together with no rest length,
+// so the matrix is the same for the x, y and z parts and is solved for all three
+// at once. Locked particles are held at dv = 0.
+//
+// Small systems whose matrix has a narrow band, such as a grid numbered row by row,
+// are factored directly (banded Cholesky) and the factor is kept while h and the
+// locked particles stay the same. Anything else is solved by conjugate gradient.
+// Its preconditioner is either the diagonal or a multigrid V-cycle over the grid the
+// particles were built on, coarsened 2x per level, which carries smooth errors across
+// the whole mesh in one application instead of one spring per iteration
+class SpringSolver
+{
+public:
+	enum Preconditioner
+	{
+		PRECONDITION_JACOBI,
+		PRECONDITION_MULTIGRID
+	};
+
+	Preconditioner preconditioner;
+
+	// Stops once the residual is this small relative to b
+	double tolerance;
+	int maxIterations;
+
+	// Gauss-Seidel sweeps before and after each coarse correction
+	int smoothingSweeps;
+
+	// Largest system, and widest band, solved directly (0 = always iterate)
+	int maxDirectSize;
+	int maxDirectBandwidth;
+
+	SpringSolver();
+
+	// Sets up the matrix for n particles. gridCells[p] is the cell, row * gridCols + col,
+	// particle p was built at. Without a complete grid (gridCells empty, or not every
+	// cell used exactly once) the multigrid preconditioner falls back to Jacobi
+	void build(const std::vector<double> & masses, const std::vector<SolverSpring> & springs,
+				const std::vector<int> & gridCells, int gridRows, int gridCols);
+
+	// Solves for the step h, starting from dv = 0. locked[p] != 0 pins particle p.
+	// Returns the number of iterations taken
+	int solve(double h, const std::vector<Vector3> & b, const std::vector<char> & locked,
+				std::vector<Vector3> & dv);
+
+	// Levels of the multigrid hierarchy, 1 when there is none
+	int levels() const { return hierarchy.size(); }
+
+	// Iterations and relative residual of the last solve, 0 for a direct one
+	int lastIterations() const { return iterations; }
+	double lastResidual() const { return residual; }
+
+private:
+	// Sparse matrix in compressed rows. Each entry holds 'channels' values side by side,
+	// the system matrices keep their mass, damping and stiffness parts apart so a
+	// change of h is only a recombination
+	struct SparseMatrix
+	{
+		int rows;
+		int cols;
+		int channels;
+		std::vector<int> offsets;
+		std::vector<int> columns;
+		std::vector<double> values;
+
+		SparseMatrix();
+		double value(int k, int channel) const { return values[k * channels + (channels == 1 ? 0 : channel)]; }
+	};
+
+	struct Level
+	{
+		// Mass, damping and stiffness parts, P^T A P of the finer level below level 0
+		SparseMatrix parts;
+		// The parts combined for the current h, and the diagonal of that
+		std::vector<double> matrix;
+		std::vector<double> diagonal;
+
+		// Interpolates from the next coarser level onto this one, and back (its transpose)
+		SparseMatrix prolongation;
+		SparseMatrix restriction;
+
+		int gridRows;
+		int gridCols;
+
+		// Scratch vectors of the V-cycle
+		std::vector<Vector3> x;
+		std::vector<Vector3> b;
+		std::vector<Vector3> r;
+	};
+
+	static SparseMatrix multiply(const SparseMatrix & a, const SparseMatrix & b);
+	static SparseMatrix transpose(const SparseMatrix & a);
+
+	// Bilinear interpolation from a (rows + 1) / 2 by (cols + 1) / 2 grid onto a rows by cols
+	// one, fineIndex[cell] is the row of the fine matrix for each fine cell
+	static SparseMatrix gridProlongation(int rows, int cols, const std::vector<int> & fineIndex);
+
+	void combine(double h);
+	void multiply(const Level & level, const std::vector<Vector3> & x, std::vector<Vector3> & y) const;
+	void smooth(Level & level, bool forward);
+	void vcycle(int l);
+	void precondition(const std::vector<Vector3> & r, const std::vector<char> & locked, std::vector<Vector3> & z);
+	void factorBanded(const std::vector<char> & locked);
+	void solveBanded(const std::vector<Vector3> & b, std::vector<Vector3> & x) const;
+
+	std::vector<Level> hierarchy;
+
+	// Dense Cholesky factor of the coarsest level, which is solved directly
+	std::vector<double> coarseFactor;
+	double combinedH;
+
+	// Largest distance from the diagonal of an entry of level 0
+	int bandwidth;
+	// Banded Cholesky factor of level 0, row i holds L(i, i - bandwidth) .. L(i, i),
+	// and the h and locked particles it was made for
+	std::vector<double> bandFactor;
+	double factoredH;
+	std::vector<char> factoredLocked;
+
+	// Conjugate gradient vectors
+	std::vector<Vector3> r;
+	std::vector<Vector3> z;
+	std::vector<Vector3> p;
+	std::vector<Vector3> q;
+
+	int iterations;
+	double residual;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "taskgraph.h"
+
+#include <algorithm>
+
+/////////////////////////////////
+/// TaskGraph Implementation ///
+/////////////////////////////////
+
+TaskGraph::TaskGraph()
+	: nodes(), used(0)
+{
+}
+
+TaskGraph::Task TaskGraph::add(const std::function<void()> & work)
+{
+	// Nodes past 'used' are left over from earlier frames, reusing them keeps
+	// their successor lists' storage
+	if (used == nodes.size())
+		nodes.push_back(Node());
+	Node & n = nodes[used];
+	n.work = work;
+	n.successors.clear();
+	n.dependencies = 0;
+	return used++;
+}
+
+void TaskGraph::precede(Task before, Task after)
+{
+	nodes[before].successors.push_back(after);
+	++nodes[after].dependencies;
+}
+
+void TaskGraph::clear()
+{
+	used = 0;
+}
+
+int TaskGraph::size() const
+{
+	return used;
+}
+
+////////////////////////////////////
+/// TaskExecutor Implementation ///
+////////////////////////////////////
+
+TaskExecutor::TaskExecutor(int threads)
+	: queues(), workers(), graph(NULL), pending(), pendingSize(0), remaining(0),
+	  stateLock(), wake(), done(), generation(0), busy(0), stopping(false)
+{
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int i = 0; i < threads; ++i)
+		queues.push_back(new Queue());
+	// Queue 0 belongs to the thread calling run()
+	for (int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(&TaskExecutor::workerLoop, this, i));
+}
+
+TaskExecutor::~TaskExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (int i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	for (int i = 0; i < queues.size(); ++i)
+		delete queues[i];
+}
+
+void TaskExecutor::run(TaskGraph & g)
+{
+	const int n = g.size();
+	if (n == 0)
+		return;
+
+	if (pendingSize < n)
+	{
+		pending.reset(new std::atomic<int>[n]);
+		pendingSize = n;
+	}
+	for (int i = 0; i < n; ++i)
+		pending[i].store(g.nodes[i].dependencies, std::memory_order_relaxed);
+	graph = &g;
+	remaining.store(n);
+
+	// Tasks with nothing to wait for are dealt out to all the queues up front
+	int next = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		if (g.nodes[i].dependencies == 0)
+		{
+			push(next, i);
+			next = (next + 1) % queues.size();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		++generation;
+		busy = workers.size();
+	}
+	wake.notify_all();
+
+	work(0);
+
+	// The pool threads may still be looking for work, the graph has to
+	// outlive that
+	std::unique_lock<std::mutex> lock(stateLock);
+	done.wait(lock, [this]() { return busy == 0; });
+	graph = NULL;
+}
+
+void TaskExecutor::workerLoop(int index)
+{
+	int seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(stateLock);
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		work(index);
+
+		std::lock_guard<std::mutex> lock(stateLock);
+		if (--busy == 0)
+			done.notify_all();
+	}
+}
+
+void TaskExecutor::work(int index)
+{
+	while (remaining.load() > 0)
+	{
+		TaskGraph::Task task;
+		if (!pop(index, task) && !steal(index, task))
+		{
+			// Everything left is running elsewhere or waiting on it
+			std::this_thread::yield();
+			continue;
+		}
+
+		const TaskGraph::Node & node = graph->nodes[task];
+		node.work();
+		for (int i = 0; i < node.successors.size(); ++i)
+		{
+			int s = node.successors[i];
+			if (--pending[s] == 0)
+				push(index, s);
+		}
+		--remaining;
+	}
+}
+
+bool TaskExecutor::pop(int index, TaskGraph::Task & task)
+{
+	Queue & q = *queues[index];
+	std::lock_guard<std::mutex> lock(q.lock);
+	if (q.tasks.empty())
+		return false;
+	task = q.tasks.back();
+	q.tasks.pop_back();
+	return true;
+}
+
+bool TaskExecutor::steal(int index, TaskGraph::Task & task)
+{
+	for (int k = 1; k < queues.size(); ++k)
+	{
+		Queue & q = *queues[(index + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(q.lock);
+		if (!q.tasks.empty())
+		{
+			task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskExecutor::push(int index, TaskGraph::Task task)
+{
+	Queue & q = *queues[index];
+	std::lock_guard<std::mutex> lock(q.lock);
+	q.tasks.push_back(task);
+}
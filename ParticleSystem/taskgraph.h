@@ -0,0 +1,108 @@
+#ifndef __TASKGRAPH_H__
+#define __TASKGRAPH_H__
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+
+// A set of tasks and the order some of them have to run in, built once per
+// frame and handed to a TaskExecutor. Tasks without a path between them may
+// run at the same time
+class TaskGraph
+{
+public:
+	typedef int Task;
+
+	TaskGraph();
+
+	// Adds a task and returns its id
+	Task add(const std::function<void()> & work);
+
+	// after starts only once before has finished
+	void precede(Task before, Task after);
+
+	// Removes all tasks, keeping the storage for the next frame
+	void clear();
+
+	// Number of tasks added since the last clear()
+	int size() const;
+
+private:
+	friend class TaskExecutor;
+
+	struct Node
+	{
+		std::function<void()> work;
+		std::vector<Task> successors;
+		// Number of tasks that have to finish before this one can start
+		int dependencies;
+	};
+
+	std::vector<Node> nodes;
+	int used;
+};
+
+// Runs task graphs on a fixed pool of threads. Each thread has its own queue:
+// it takes the newest task from its own queue (whose data is likely still in
+// cache) and, when that is empty, steals the oldest task from another thread.
+// A task that becomes ready goes onto the queue of the thread that finished
+// its last dependency
+class TaskExecutor
+{
+public:
+	// threads counts the calling thread, 0 means one per hardware thread
+	TaskExecutor(int threads = 0);
+	~TaskExecutor();
+
+	// Runs every task of the graph and returns once all have finished.
+	// The calling thread works on the graph too
+	void run(TaskGraph & graph);
+
+	int threadCount() const { return queues.size(); }
+
+private:
+	// Not copyable, the threads hold a pointer to the executor
+	TaskExecutor(const TaskExecutor &);
+	TaskExecutor & operator=(const TaskExecutor &);
+
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<TaskGraph::Task> tasks;
+	};
+
+	// Body of the pool threads
+	void workerLoop(int index);
+
+	// Executes tasks as thread index until the graph has none left
+	void work(int index);
+
+	bool pop(int index, TaskGraph::Task & task);
+	bool steal(int index, TaskGraph::Task & task);
+	void push(int index, TaskGraph::Task task);
+
+	std::vector<Queue*> queues;
+	std::vector<std::thread> workers;
+
+	// The graph being run and, for each of its tasks, the dependencies still unfinished
+	TaskGraph * graph;
+	std::unique_ptr<std::atomic<int>[]> pending;
+	int pendingSize;
+	std::atomic<int> remaining;
+
+	// Wakes the pool when a graph starts, run() waits on done until every pool
+	// thread has left the graph
+	std::mutex stateLock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	int generation;
+	int busy;
+	bool stopping;
+};
+
+#endif
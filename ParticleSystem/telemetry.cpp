@@ -0,0 +1,311 @@
+#include "telemetry.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char * const TELEMETRY_NAME = "SpringMassTelemetry";
+
+// "SMT1", checked by the reader so it doesn't read some other mapping
+static const unsigned int TELEMETRY_MAGIC = 0x31544d53;
+static const unsigned int TELEMETRY_VERSION = 2;
+
+FrameStats::FrameStats()
+	: frame(0), stepMs(0.0), systems(0), particles(0), springs(0),
+	  collisionHits(0), allocations(0), overrunMs(0)
+{
+	for (int i = 0; i < PHASE_COUNT; ++i)
+		phaseMs[i] = 0.0;
+}
+
+////////////////////////////
+/// Shared memory access ///
+////////////////////////////
+
+// Maps the named shared memory, creating it when writable. Returns NULL on
+// failure, 'handle' receives what unmap() needs to release it
+static void * mapShared(const char * name, bool writable, void ** handle)
+{
+	const size_t size = sizeof(TelemetryRing);
+	*handle = NULL;
+#ifdef _WIN32
+	std::string path = std::string("Local\\") + name;
+	HANDLE h = writable
+		? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, path.c_str())
+		: OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+	if (h == NULL)
+		return NULL;
+	void * p = MapViewOfFile(h, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+	if (p == NULL)
+	{
+		CloseHandle(h);
+		return NULL;
+	}
+	*handle = h;
+	return p;
+#else
+	std::string path = std::string("/") + name;
+	int fd = writable ? shm_open(path.c_str(), O_CREAT | O_RDWR, 0644) : shm_open(path.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	struct stat info;
+	if ((writable && ftruncate(fd, size) != 0) || fstat(fd, &info) != 0 || info.st_size < (off_t)size)
+	{
+		::close(fd);
+		return NULL;
+	}
+	void * p = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static void unmapShared(const void * p, void * handle)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(p);
+	CloseHandle(handle);
+#else
+	// Only Windows keeps a handle besides the view
+	(void)handle;
+	munmap(const_cast<void *>(p), sizeof(TelemetryRing));
+#endif
+}
+
+// Removes the name of shared memory made by mapShared. Windows frees the
+// mapping with its last handle, elsewhere it lasts until removed
+static void unlinkShared(const char * name)
+{
+#ifndef _WIN32
+	shm_unlink((std::string("/") + name).c_str());
+#endif
+}
+
+//////////////////////////////////////
+/// TelemetryWriter Implementation ///
+//////////////////////////////////////
+
+TelemetryWriter::TelemetryWriter()
+	: ring(NULL), mapping(NULL), sharedName()
+{
+}
+
+TelemetryWriter::~TelemetryWriter()
+{
+	close();
+}
+
+bool TelemetryWriter::open(const char * name)
+{
+	close();
+	void * p = mapShared(name, true, &mapping);
+	if (p == NULL)
+		return false;
+
+	// The magic goes in last so a reader never sees a half set up ring
+	TelemetryRing * r = static_cast<TelemetryRing *>(p);
+	r->magic = 0;
+	std::atomic_thread_fence(std::memory_order_release);
+	r = new (p) TelemetryRing();
+	r->version = TELEMETRY_VERSION;
+	r->capacity = TELEMETRY_CAPACITY;
+	r->slotSize = sizeof(TelemetrySlot);
+	r->session = std::chrono::system_clock::now().time_since_epoch().count();
+	r->written.store(0);
+	for (int i = 0; i < TELEMETRY_CAPACITY; ++i)
+		r->slots[i].sequence.store(0);
+	std::atomic_thread_fence(std::memory_order_release);
+	r->magic = TELEMETRY_MAGIC;
+	ring = r;
+	sharedName = name;
+	return true;
+}
+
+void TelemetryWriter::close()
+{
+	if (ring == NULL)
+		return;
+	unmapShared(ring, mapping);
+	unlinkShared(sharedName.c_str());
+	ring = NULL;
+	mapping = NULL;
+}
+
+void TelemetryWriter::publish(const FrameStats & stats)
+{
+	if (ring == NULL)
+		return;
+	unsigned long long n = ring->written.load(std::memory_order_relaxed);
+	TelemetrySlot & slot = ring->slots[n % TELEMETRY_CAPACITY];
+
+	slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.stats = stats;
+	slot.sequence.store(2 * n + 2, std::memory_order_release);
+	ring->written.store(n + 1, std::memory_order_release);
+}
+
+//////////////////////////////////////
+/// TelemetryReader Implementation ///
+//////////////////////////////////////
+
+TelemetryReader::TelemetryReader()
+	: ring(NULL), mapping(NULL), next(0), droppedFrames(0)
+{
+}
+
+TelemetryReader::~TelemetryReader()
+{
+	close();
+}
+
+bool TelemetryReader::open(const char * name)
+{
+	close();
+	if (!attach(name))
+		return false;
+	rewind();
+	droppedFrames = 0;
+	return true;
+}
+
+bool TelemetryReader::reopen(const char * name)
+{
+	const TelemetryRing * oldRing = ring;
+	void * oldMapping = mapping;
+	if (!attach(name))
+		return false;
+
+	// Every frame of a restarted simulation is new to us
+	if (oldRing == NULL || oldRing->session != ring->session)
+		rewind();
+	if (oldRing != NULL)
+		unmapShared(oldRing, oldMapping);
+	return true;
+}
+
+void TelemetryReader::rewind()
+{
+	// Start with what is still in the ring
+	unsigned long long written = ring->written.load(std::memory_order_acquire);
+	next = written > TELEMETRY_CAPACITY ? written - TELEMETRY_CAPACITY : 0;
+}
+
+bool TelemetryReader::attach(const char * name)
+{
+	void * handle;
+	void * p = mapShared(name, false, &handle);
+	if (p == NULL)
+		return false;
+
+	const TelemetryRing * r = static_cast<const TelemetryRing *>(p);
+	if (r->magic != TELEMETRY_MAGIC || r->version != TELEMETRY_VERSION ||
+		r->capacity != TELEMETRY_CAPACITY || r->slotSize != sizeof(TelemetrySlot))
+	{
+		unmapShared(p, handle);
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	ring = r;
+	mapping = handle;
+	return true;
+}
+
+void TelemetryReader::close()
+{
+	if (ring == NULL)
+		return;
+	unmapShared(ring, mapping);
+	ring = NULL;
+	mapping = NULL;
+}
+
+int TelemetryReader::poll(std::vector<FrameStats> & out)
+{
+	if (ring == NULL)
+		return 0;
+
+	unsigned long long written = ring->written.load(std::memory_order_acquire);
+	// The simulation was restarted and counts from zero again
+	if (written < next)
+		next = 0;
+	// Fell more than a whole ring behind, what is missing has been overwritten
+	if (written - next > TELEMETRY_CAPACITY)
+	{
+		droppedFrames += written - TELEMETRY_CAPACITY - next;
+		next = written - TELEMETRY_CAPACITY;
+	}
+
+	int count = 0;
+	for (; next < written; ++next)
+	{
+		const TelemetrySlot & slot = ring->slots[next % TELEMETRY_CAPACITY];
+		unsigned long long before = slot.sequence.load(std::memory_order_acquire);
+		FrameStats stats;
+		std::memcpy(&stats, &slot.stats, sizeof(FrameStats));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned long long after = slot.sequence.load(std::memory_order_relaxed);
+
+		// Anything but frame 'next' finished and untouched during the copy means
+		// the writer has lapped us on this slot
+		if (before != 2 * next + 2 || after != before)
+		{
+			++droppedFrames;
+			continue;
+		}
+		out.push_back(stats);
+		++count;
+	}
+	return count;
+}
+
+//////////////////////////
+/// Allocation counter ///
+//////////////////////////
+
+// Off unless the build asks for it: replacing operator new puts an atomic
+// increment on every allocation of whatever links this file
+#ifdef TELEMETRY_COUNT_ALLOCATIONS
+
+static std::atomic<long long> allocations(0);
+
+long long allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+// Replacing the global operator new counts every allocation in the process,
+// the array form ends up here too
+void * operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void * p = std::malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) throw()
+{
+	std::free(p);
+}
+
+#else
+
+long long allocationCount()
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Parts of a simulation step that are timed separately
+enum TelemetryPhase
+{
+	PHASE_COLLIDE,		// balls against the strands
+	PHASE_STEP,			// forces, colliders and integration
+	PHASE_CLEANUP,		// expired particles and finished systems
+	PHASE_BALLS,		// moving the balls
+	PHASE_PUBLISH,		// snapshot for the renderer
+	PHASE_COUNT
+};
+
+// What one simulation step reports. Plain data, it is copied as is into
+// shared memory and read back by another process
+struct FrameStats
+{
+	unsigned long long frame;
+
+	// Wall time of the whole step and the time spent in each phase, in milliseconds.
+	// When the phases run as parallel tasks their times are summed over all threads
+	double stepMs;
+	double phaseMs[PHASE_COUNT];
+
+	int systems;
+	int particles;
+	int springs;
+
+	// Spring segments hit by a ball during the step
+	int collisionHits;
+
+	// Heap allocations made by the whole process since the last step,
+	// -1 when the simulation isn't built to count them (see allocationCount)
+	long long allocations;
+
+	// How much longer than FRAME_RATE the last frame took, 0 if it was on time
+	int overrunMs;
+
+	FrameStats();
+};
+
+// Name of the shared memory the simulation publishes to
+extern const char * const TELEMETRY_NAME;
+
+// Number of frames the ring keeps, about 40 seconds at 25 frames a second
+const int TELEMETRY_CAPACITY = 1024;
+
+// Layout of the shared memory. Each slot is guarded by its own sequence number:
+// odd while the writer is copying frame n into it (2n + 1), 2n + 2 once done.
+// A reader copies a slot and keeps the copy only if the sequence was the same
+// even number before and after, so the writer never waits for anyone
+struct TelemetrySlot
+{
+	std::atomic<unsigned long long> sequence;
+	FrameStats stats;
+};
+
+struct TelemetryRing
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int capacity;
+	unsigned int slotSize;
+	// Different every time a writer opens the ring, tells a restarted
+	// simulation from the one a reader was following
+	unsigned long long session;
+	// Frames published so far
+	std::atomic<unsigned long long> written;
+	TelemetrySlot slots[TELEMETRY_CAPACITY];
+};
+
+// Simulation side: creates the shared memory and publishes one FrameStats per step
+class TelemetryWriter
+{
+public:
+	TelemetryWriter();
+	~TelemetryWriter();
+
+	// Creates (or takes over) the named shared memory, returns false if that failed,
+	// in which case publish() does nothing
+	bool open(const char * name = TELEMETRY_NAME);
+	// Unmaps the shared memory and removes its name, readers still attached
+	// keep what they have mapped
+	void close();
+	bool isOpen() const { return ring != NULL; }
+
+	// Copies the stats into the next slot, never blocks
+	void publish(const FrameStats & stats);
+
+private:
+	// Not copyable, the mapping is released once
+	TelemetryWriter(const TelemetryWriter &);
+	TelemetryWriter & operator=(const TelemetryWriter &);
+
+	TelemetryRing * ring;
+	void * mapping;
+	std::string sharedName;
+};
+
+// Reader side: maps the shared memory read-only and collects the frames
+// published since the last poll
+class TelemetryReader
+{
+public:
+	TelemetryReader();
+	~TelemetryReader();
+
+	// Returns false if the simulation hasn't created the shared memory yet
+	bool open(const char * name = TELEMETRY_NAME);
+	// Maps the shared memory by name again and carries on from the last frame read.
+	// A restarted simulation creates new shared memory that an open reader never
+	// sees otherwise. Keeps the current mapping and returns false if there is none
+	bool reopen(const char * name = TELEMETRY_NAME);
+	void close();
+	bool isOpen() const { return ring != NULL; }
+
+	// Appends the frames published since the last call to out and returns how many.
+	// Frames overwritten before they could be read are counted in dropped()
+	int poll(std::vector<FrameStats> & out);
+
+	unsigned long long dropped() const { return droppedFrames; }
+
+private:
+	TelemetryReader(const TelemetryReader &);
+	TelemetryReader & operator=(const TelemetryReader &);
+
+	// Maps and checks the named ring, leaves ring and mapping as they were on failure
+	bool attach(const char * name);
+	// Goes back to the oldest frame still in the ring
+	void rewind();
+
+	const TelemetryRing * ring;
+	void * mapping;
+	unsigned long long next;
+	unsigned long long droppedFrames;
+};
+
+// Heap allocations made by the process so far, or -1 if they aren't counted.
+// They are only counted in builds that define TELEMETRY_COUNT_ALLOCATIONS,
+// which replaces the global operator new (see telemetry.cpp)
+long long allocationCount();
+
+#endif
@@ -1,34 +1,126 @@
 #ifndef __VECTOR3_H__
 #define __VECTOR3_H__
 #include <stdio.h>
+#include <cmath>
+
+// Visual Studio 2013 (v120) doesn't support constexpr
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define VECTOR3_CONSTEXPR inline
+#else
+#define VECTOR3_CONSTEXPR constexpr
+#endif
+
 // A simple wrapper for store 3D vectors
+// Everything is defined in this header so it inlines into the simulation loops
 struct Vector3
 {
 	double x;
 	double y;
 	double z;
 
-	Vector3();
-	Vector3(double x, double y, double z);
-	Vector3(const Vector3 & v);
-
-	Vector3 operator+(const Vector3 & rhs) const;
-	Vector3 operator-(const Vector3 & rhs) const;
-	Vector3 operator*(double rhs) const;
-	Vector3 operator/(double rhs) const;
-	Vector3 operator+=(const Vector3 & rhs);
-	Vector3 operator-=(const Vector3 & rhs);
-	Vector3 operator*=(double rhs);
-	Vector3 operator/=(double rhs);
-
-	double magnitude() const;
-	void normalize();
-	Vector3 normalized() const;
-	double dot(const Vector3 & rhs) const;
-	Vector3 cross(const Vector3 & rhs) const;
-	Vector3 rotate(const Vector3 & axis, double angle);
+	VECTOR3_CONSTEXPR Vector3()
+		: x(0.0), y(0.0), z(0.0)
+	{}
+	VECTOR3_CONSTEXPR Vector3(double x, double y, double z)
+		: x(x), y(y), z(z)
+	{}
+
+	VECTOR3_CONSTEXPR Vector3 operator+(const Vector3 & rhs) const
+	{
+		return Vector3(x + rhs.x, y + rhs.y, z + rhs.z);
+	}
+	VECTOR3_CONSTEXPR Vector3 operator-(const Vector3 & rhs) const
+	{
+		return Vector3(x - rhs.x, y - rhs.y, z - rhs.z);
+	}
+	VECTOR3_CONSTEXPR Vector3 operator*(double rhs) const
+	{
+		return Vector3(x * rhs, y * rhs, z * rhs);
+	}
+	VECTOR3_CONSTEXPR Vector3 operator/(double rhs) const
+	{
+		return Vector3(x / rhs, y / rhs, z / rhs);
+	}
+
+	// Compound operators modify in place and return a reference, no copies
+	Vector3 & operator+=(const Vector3 & rhs)
+	{
+		x += rhs.x; y += rhs.y; z += rhs.z;
+		return *this;
+	}
+	Vector3 & operator-=(const Vector3 & rhs)
+	{
+		x -= rhs.x; y -= rhs.y; z -= rhs.z;
+		return *this;
+	}
+	Vector3 & operator*=(double rhs)
+	{
+		x *= rhs; y *= rhs; z *= rhs;
+		return *this;
+	}
+	Vector3 & operator/=(double rhs)
+	{
+		x /= rhs; y /= rhs; z /= rhs;
+		return *this;
+	}
+
+	// this += v * s without a temporary (axpy), e.g. vel.addScaled(acc, dt)
+	Vector3 & addScaled(const Vector3 & v, double s)
+	{
+		x += v.x * s; y += v.y * s; z += v.z * s;
+		return *this;
+	}
+
+	double magnitude() const
+	{
+		return std::sqrt(x * x + y * y + z * z);
+	}
+	void normalize()
+	{
+		*this /= magnitude();
+	}
+	Vector3 normalized() const
+	{
+		return *this / magnitude();
+	}
+	VECTOR3_CONSTEXPR double dot(const Vector3 & rhs) const
+	{
+		return x * rhs.x + y * rhs.y + z * rhs.z;
+	}
+	VECTOR3_CONSTEXPR Vector3 cross(const Vector3 & rhs) const
+	{
+		return Vector3(y * rhs.z - z * rhs.y,
+			z * rhs.x - x * rhs.z,
+			x * rhs.y - y * rhs.x);
+	}
+	Vector3 rotate(const Vector3 & axis, double angle) const;
 	void print() const { printf("%f, %f, %f\n", x,y,z); }
-	    
+
 };
 
+// Rotates about a unit axis by angle radians (Rodrigues' rotation formula)
+inline Vector3 Vector3::rotate(const Vector3 & axis, double angle) const
+{
+	double cosTheta = std::cos(angle);
+	double sinTheta = std::sin(angle);
+	double aXX = axis.x * axis.x;
+	double aXY = axis.x * axis.y;
+	double aXZ = axis.x * axis.z;
+	double aYY = axis.y * axis.y;
+	double aYZ = axis.y * axis.z;
+	double aZZ = axis.z * axis.z;
+
+	double nx = x * (cosTheta + aXX * (1 - cosTheta)) +
+				y * (aXY * (1 - cosTheta) - axis.z * sinTheta) +
+				z * (aXZ * (1 - cosTheta) + axis.y * sinTheta);
+	double ny = x * (aXY * (1 - cosTheta) + axis.z * sinTheta) +
+				y * (cosTheta + aYY * (1 - cosTheta)) +
+				z * (aYZ * (1 - cosTheta) - axis.x * sinTheta);
+	double nz = x * (aXZ * (1 - cosTheta) - axis.y * sinTheta) +
+				y * (aYZ * (1 - cosTheta) + axis.x * sinTheta) +
+				z * (cosTheta + aZZ * (1 - cosTheta));
+
+	return Vector3(nx, ny, nz);
+}
+
 #endif
@@ -0,0 +1,131 @@
+// Prints what a running simulation publishes through telemetry.h: every interval
+// one line with the averages of the frames published during it. Only reads the
+// shared memory, so it can be started, stopped and restarted at any time without
+// the simulation noticing. A simulation restarted while it runs is picked up
+// a few intervals after the old one stops
+
+#include "../ParticleSystem/telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Intervals without a new frame before the shared memory is looked up by name again
+static const int REOPEN_INTERVALS = 3;
+
+static const char * option(const char * arg, const char * name)
+{
+	size_t n = strlen(name);
+	if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+		return arg + n + 1;
+	return NULL;
+}
+
+static void printHeader()
+{
+	printf("%8s %6s %8s %8s %8s %8s %8s %8s %8s %9s %7s %7s %10s %8s\n",
+		"frame", "frames", "step", "max", "collide", "update", "cleanup", "balls", "publish",
+		"particles", "hits", "overrun", "allocs", "dropped");
+	printf("%8s %6s %8s %8s %8s %8s %8s %8s %8s %9s %7s %7s %10s %8s\n",
+		"", "", "ms", "ms", "ms", "ms", "ms", "ms", "ms", "", "/frame", "frames", "/frame", "");
+}
+
+// One line for the frames published during an interval
+static void printInterval(const std::vector<FrameStats> & frames, unsigned long long dropped)
+{
+	const int n = frames.size();
+	double stepMs = 0.0;
+	double maxMs = 0.0;
+	double phaseMs[PHASE_COUNT] = {};
+	double hits = 0.0;
+	double allocations = 0.0;
+	bool counted = true;
+	int overruns = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		const FrameStats & f = frames[i];
+		stepMs += f.stepMs;
+		maxMs = std::max(maxMs, f.stepMs);
+		for (int p = 0; p < PHASE_COUNT; ++p)
+			phaseMs[p] += f.phaseMs[p];
+		hits += f.collisionHits;
+		allocations += f.allocations;
+		counted = counted && f.allocations >= 0;
+		if (f.overrunMs > 0)
+			++overruns;
+	}
+
+	// Simulations built without counting report -1
+	char allocationText[32] = "-";
+	if (counted)
+		sprintf(allocationText, "%.1f", allocations / n);
+
+	const FrameStats & last = frames.back();
+	printf("%8llu %6d %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %9d %7.1f %7d %10s %8llu\n",
+		last.frame, n, stepMs / n, maxMs,
+		phaseMs[PHASE_COLLIDE] / n, phaseMs[PHASE_STEP] / n, phaseMs[PHASE_CLEANUP] / n,
+		phaseMs[PHASE_BALLS] / n, phaseMs[PHASE_PUBLISH] / n,
+		last.particles, hits / n, overruns, allocationText, dropped);
+	fflush(stdout);
+}
+
+int main(int argc, char ** argv)
+{
+	std::string name = TELEMETRY_NAME;
+	double interval = 1.0;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char * value;
+		if ((value = option(argv[i], "--name")))
+			name = value;
+		else if ((value = option(argv[i], "--interval")))
+			interval = atof(value);
+		else
+		{
+			fprintf(stderr, "usage: %s [--name=<shared memory>] [--interval=<seconds>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	TelemetryReader reader;
+	while (!reader.open(name.c_str()))
+	{
+		fprintf(stderr, "waiting for the simulation to publish to %s\n", name.c_str());
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	printHeader();
+
+	// Polling a few times an interval keeps well ahead of the ring wrapping around
+	typedef std::chrono::steady_clock Clock;
+	std::vector<FrameStats> frames;
+	unsigned long long dropped = 0;
+	int quietIntervals = 0;
+	Clock::time_point lastPrint = Clock::now();
+	while (true)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		reader.poll(frames);
+
+		if (std::chrono::duration<double>(Clock::now() - lastPrint).count() < interval)
+			continue;
+		lastPrint = Clock::now();
+		if (!frames.empty())
+			printInterval(frames, reader.dropped() - dropped);
+		dropped = reader.dropped();
+
+		// The simulation removes its shared memory when it exits and a restarted
+		// one creates new, so once nothing has come for a while look it up again
+		quietIntervals = frames.empty() ? quietIntervals + 1 : 0;
+		if (quietIntervals >= REOPEN_INTERVALS)
+		{
+			reader.reopen(name.c_str());
+			quietIntervals = 0;
+		}
+		frames.clear();
+	}
+}
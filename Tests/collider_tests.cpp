@@ -0,0 +1,233 @@
+#include "test.h"
+
+#include "../ParticleSystem/collider.h"
+#include "../ParticleSystem/particlesystem.h"
+#include "../ParticleSystem/const.h"
+
+static const double TOLERANCE = 1e-12;
+
+// Runs one particle through a set holding only c
+static Particle resolveOne(const Collider & c, const Vector3 & pos, const Vector3 & vel)
+{
+	ColliderSet set;
+	set.addStatic(c);
+	Particle p(pos, vel);
+	std::vector<Particle*> particles(1, &p);
+	set.resolve(particles);
+	return p;
+}
+
+static bool near(const Vector3 & a, const Vector3 & b)
+{
+	return std::abs(a.x - b.x) <= TOLERANCE && std::abs(a.y - b.y) <= TOLERANCE && std::abs(a.z - b.z) <= TOLERANCE;
+}
+
+TEST(PlanePushesOutAlongNormal)
+{
+	Particle p = resolveOne(Collider::plane(Vector3(), Vector3(0.0, 1.0, 0.0)),
+							Vector3(5.0, -2.0, 0.0), Vector3(1.0, -3.0, 0.0));
+	CHECK(near(p.pos, Vector3(5.0, 0.0, 0.0)));
+	CHECK(near(p.vel, Vector3(1.0, 3.0, 0.0)));
+	CHECK(!p.isLocked);
+}
+
+TEST(PlaneKeepsSpeedLeavingIt)
+{
+	// Already moving out, only the position is fixed
+	Particle p = resolveOne(Collider::plane(Vector3(), Vector3(0.0, 1.0, 0.0)),
+							Vector3(5.0, -2.0, 0.0), Vector3(1.0, 3.0, 0.0));
+	CHECK(near(p.pos, Vector3(5.0, 0.0, 0.0)));
+	CHECK(near(p.vel, Vector3(1.0, 3.0, 0.0)));
+}
+
+TEST(BoxPushesOutThroughNearestFace)
+{
+	Collider box = Collider::box(Vector3(0.0, 0.0, 0.0), Vector3(10.0, 10.0, 10.0));
+	Particle p = resolveOne(box, Vector3(9.5, 4.0, 5.0), Vector3(-2.0, 1.0, 0.0));
+	CHECK(near(p.pos, Vector3(10.0, 4.0, 5.0)));
+	CHECK(near(p.vel, Vector3(2.0, 1.0, 0.0)));
+
+	p = resolveOne(box, Vector3(4.0, 5.0, 0.25), Vector3(0.0, 0.0, 3.0));
+	CHECK(near(p.pos, Vector3(4.0, 5.0, 0.0)));
+	CHECK(near(p.vel, Vector3(0.0, 0.0, -3.0)));
+
+	// Outside along any axis is no contact
+	p = resolveOne(box, Vector3(11.0, 5.0, 5.0), Vector3(-2.0, 0.0, 0.0));
+	CHECK(near(p.pos, Vector3(11.0, 5.0, 5.0)));
+	CHECK(near(p.vel, Vector3(-2.0, 0.0, 0.0)));
+}
+
+TEST(SpherePushesOutRadially)
+{
+	Particle p = resolveOne(Collider::sphere(Vector3(1.0, 1.0, 1.0), 2.0),
+							Vector3(1.0, 2.0, 1.0), Vector3(0.0, -4.0, 1.0));
+	CHECK(near(p.pos, Vector3(1.0, 3.0, 1.0)));
+	CHECK(near(p.vel, Vector3(0.0, 4.0, 1.0)));
+}
+
+TEST(CapsulePushesOutFromItsSegment)
+{
+	Collider capsule = Collider::capsule(Vector3(0.0, 0.0, 0.0), Vector3(10.0, 0.0, 0.0), 1.0);
+	Particle p = resolveOne(capsule, Vector3(5.0, 0.5, 0.0), Vector3(0.0, -1.0, 0.0));
+	CHECK(near(p.pos, Vector3(5.0, 1.0, 0.0)));
+	CHECK(near(p.vel, Vector3(0.0, 1.0, 0.0)));
+
+	// Past an end it is round like a sphere
+	p = resolveOne(capsule, Vector3(10.5, 0.0, 0.0), Vector3(-1.0, 0.0, 0.0));
+	CHECK(near(p.pos, Vector3(11.0, 0.0, 0.0)));
+	CHECK(near(p.vel, Vector3(1.0, 0.0, 0.0)));
+}
+
+TEST(RestitutionAndStickiness)
+{
+	Particle p = resolveOne(Collider::plane(Vector3(), Vector3(0.0, 1.0, 0.0), 0.0, true),
+							Vector3(0.0, -1.0, 0.0), Vector3(2.0, -3.0, 0.0));
+	CHECK(near(p.vel, Vector3(2.0, 0.0, 0.0)));
+	CHECK(p.isLocked);
+
+	p = resolveOne(Collider::plane(Vector3(), Vector3(0.0, 1.0, 0.0), 0.5),
+					Vector3(0.0, -1.0, 0.0), Vector3(0.0, -4.0, 0.0));
+	CHECK(near(p.vel, Vector3(0.0, 2.0, 0.0)));
+	CHECK(!p.isLocked);
+}
+
+TEST(ManyStaticsMatchOneByOne)
+{
+	// The hierarchy only culls, every particle ends where checking each
+	// collider on its own would put it
+	std::vector<Collider> spheres;
+	for (int i = 0; i < 200; ++i)
+		spheres.push_back(Collider::sphere(Vector3((i % 20) * 10.0, (i / 20) * 10.0, 0.0), 3.0));
+	ColliderSet set;
+	set.addStatic(spheres);
+
+	std::vector<Particle> a;
+	for (int i = 0; i < 500; ++i)
+		a.push_back(Particle(Vector3((i * 37 % 2000) * 0.1, (i * 53 % 1000) * 0.1, 0.0), Vector3(1.0, -1.0, 0.0)));
+	std::vector<Particle> b = a;
+
+	std::vector<Particle*> all;
+	for (int i = 0; i < a.size(); ++i)
+		all.push_back(&a[i]);
+	set.resolve(all);
+
+	for (int i = 0; i < b.size(); ++i)
+	{
+		std::vector<Particle*> one(1, &b[i]);
+		for (int k = 0; k < spheres.size(); ++k)
+		{
+			ColliderSet single;
+			single.addStatic(spheres[k]);
+			single.resolve(one);
+		}
+	}
+
+	bool same = true;
+	for (int i = 0; i < a.size(); ++i)
+		same = same && near(a[i].pos, b[i].pos) && near(a[i].vel, b[i].vel);
+	CHECK(same);
+}
+
+TEST(DynamicColliderFollowsMoves)
+{
+	ColliderSet set;
+	int ball = set.addDynamic(Collider::sphere(Vector3(100.0, 100.0, 0.0), 5.0));
+	Particle p(Vector3(0.0, 1.0, 0.0));
+	std::vector<Particle*> particles(1, &p);
+
+	set.resolve(particles);
+	CHECK(near(p.pos, Vector3(0.0, 1.0, 0.0)));
+
+	set.dynamicCollider(ball).a = Vector3(0.0, -2.0, 0.0);
+	set.dynamicCollider(ball).b = Vector3(0.0, -2.0, 0.0);
+	set.resolve(particles);
+	CHECK(near(p.pos, Vector3(0.0, 3.0, 0.0)));
+}
+
+// A strand that bounces off the window edges the way Particle::update did
+// before the colliders: clamp to the edge and flip the speed across it,
+// locking on the floor
+class LegacyStrand : public ParticleSystemSpringMass
+{
+public:
+	LegacyStrand(const Vector3 & location)
+		: ParticleSystemSpringMass(location)
+	{
+		colliders = NULL;
+	}
+
+	virtual void resolveCollisions()
+	{
+		for (int i = 0; i < particles.size(); ++i)
+		{
+			Particle & p = *particles[i];
+			if (p.pos.x >= WINDOW_WIDTH)
+			{
+				p.pos.x = WINDOW_WIDTH;
+				p.vel.x *= -1.0;
+			}
+			if (p.pos.x <= 0.0)
+			{
+				p.pos.x = 0.0;
+				p.vel.x *= -1.0;
+			}
+			if (p.pos.y >= WINDOW_HEIGHT)
+			{
+				p.pos.y = WINDOW_HEIGHT;
+				p.vel.y *= -1.0;
+			}
+			if (p.pos.y <= 0.0)
+			{
+				p.pos.y = 0.0;
+				p.vel.y *= -1.0;
+				p.isLocked = true;
+			}
+		}
+	}
+};
+
+TEST(WindowCollidersMatchLegacyBounce)
+{
+	// Six strands thrown at the walls, floor and ceiling end bit-identical
+	const Vector3 starts[6] = {
+		Vector3(20.0, 300.0, 0.0), Vector3(690.0, 300.0, 0.0), Vector3(300.0, 30.0, 0.0),
+		Vector3(300.0, 770.0, 0.0), Vector3(10.0, 10.0, 0.0), Vector3(700.0, 760.0, 0.0)
+	};
+	const Vector3 throws[6] = {
+		Vector3(-200.0, 0.0, 0.0), Vector3(250.0, 50.0, 0.0), Vector3(30.0, -150.0, 0.0),
+		Vector3(-40.0, 300.0, 0.0), Vector3(-100.0, -100.0, 0.0), Vector3(150.0, 150.0, 0.0)
+	};
+
+	bool same = true;
+	bool hit = false;
+	for (int s = 0; s < 6; ++s)
+	{
+		ParticleSystemSpringMass strand(starts[s]);
+		LegacyStrand legacy(starts[s]);
+		for (int i = 0; i < strand.particles.size(); ++i)
+		{
+			strand.particles[i]->vel = throws[s];
+			legacy.particles[i]->vel = throws[s];
+		}
+
+		for (int step = 0; step < 2000; ++step)
+		{
+			strand.update(FRAME_DT);
+			legacy.update(FRAME_DT);
+		}
+
+		for (int i = 0; i < strand.particles.size(); ++i)
+		{
+			const Particle & a = *strand.particles[i];
+			const Particle & b = *legacy.particles[i];
+			// The old bounce kept flipping the speed of particles locked on the
+			// floor every step, the colliders leave it be. It never moves them
+			bool sameVel = a.vel.x == b.vel.x && a.vel.y == b.vel.y && a.vel.z == b.vel.z;
+			same = same && a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z
+				&& a.isLocked == b.isLocked && (a.isLocked || sameVel);
+			hit = hit || a.isLocked;
+		}
+	}
+	CHECK(same);
+	CHECK(hit);
+}
@@ -0,0 +1,636 @@
+#include "test.h"
+
+#include "../ParticleSystem/particlesystem.h"
+#include "../ParticleSystem/const.h"
+
+#include <map>
+
+// A particle system with no behaviour of its own, used to exercise the base class
+class TimedParticleSystem : public ParticleSystem
+{
+public:
+	TimedParticleSystem()
+	{
+		colliders = NULL;
+		looks = std::vector<ParticleLook>(1, ParticleLook());
+	}
+	virtual void init() {}
+};
+
+//////////////
+/// Expiry ///
+//////////////
+
+TEST(CleanupRemovesParticleWithFractionalTimer)
+{
+	// 0.1 * 3 counted down by three steps of 0.1 leaves about 2.8e-17, not 0
+	TimedParticleSystem ps;
+	ps.addParticle(new Particle(Vector3(), Vector3(), Vector3(), 1.0, 0.1 * 3));
+	for (int step = 0; step < 3; ++step)
+	{
+		CHECK(ps.particles.size() == 1);
+		ps.update(0.1);
+		ps.cleanup();
+	}
+	CHECK(ps.particles.empty());
+}
+
+TEST(CleanupRemovesEachParticleOnItsStep)
+{
+	const int COUNT = 50;
+	const double DT = 0.1;
+	TimedParticleSystem ps;
+	std::vector<ParticleHandle> handles;
+	for (int k = 1; k <= COUNT; ++k)
+		handles.push_back(ps.addParticle(new Particle(Vector3(), Vector3(), Vector3(), 1.0, DT * k)));
+
+	// Particle k is still there after k - 1 steps and gone after k
+	bool onTime = true;
+	for (int step = 1; step <= COUNT; ++step)
+	{
+		ps.update(DT);
+		ps.cleanup();
+		for (int k = 1; k <= COUNT; ++k)
+			onTime = onTime && (ps.find(handles[k - 1]) == NULL) == (k <= step);
+	}
+	CHECK(onTime);
+	CHECK(ps.particles.empty());
+}
+
+TEST(CleanupKeepsParticlesWithTimeLeft)
+{
+	TimedParticleSystem ps;
+	ParticleHandle h = ps.addParticle(new Particle(Vector3(), Vector3(), Vector3(), 1.0, 1.0));
+	for (int step = 0; step < 9; ++step)
+	{
+		ps.update(0.1);
+		ps.cleanup();
+	}
+	CHECK(ps.find(h) != NULL);
+
+	// Timers changed from outside are picked up through retime()
+	ps.find(h)->timer = 0.05;
+	ps.retime(ps.indexOf(h));
+	ps.update(0.05);
+	ps.cleanup();
+	CHECK(ps.find(h) == NULL);
+	CHECK(ps.isDone());
+}
+
+//////////////////////
+/// Dirty tracking ///
+//////////////////////
+
+// What a consumer kept of a chunk the last time its version changed
+struct CachedChunk
+{
+	unsigned version;
+	std::vector<Vector3> pos;
+};
+
+TEST(SnapshotPositionsAreExact)
+{
+	ParticleSystemSpringMass strand(Vector3(100.0, 0.0, 0.0));
+	for (int step = 0; step < 50; ++step)
+	{
+		strand.update(FRAME_DT);
+		strand.clearDirty();
+	}
+	FrameSnapshot frame;
+	strand.snapshot(frame);
+
+	bool exact = true;
+	for (int i = 0; i < strand.particles.size(); ++i)
+	{
+		const Vector3 & a = frame.particles[i].pos;
+		const Vector3 & b = strand.particles[i]->pos;
+		exact = exact && a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+	CHECK(exact);
+}
+
+TEST(ReusedChunksStayWithinThreshold)
+{
+	// A stand-in consumer that caches chunks by version and skips two frames in three
+	std::vector<ParticleSystem*> psystems;
+	psystems.push_back(new ParticleSystemSpringMass(Vector3(100.0, 0.0, 0.0)));
+	psystems.push_back(new ParticleSystemSpringMass(Vector3(400.0, 0.0, 0.0), 10, ParticleSystemSpringMass::REORDER_MORTON));
+	static_cast<ParticleSystemSpringMass*>(psystems[1])->setDetail(ParticleSystemSpringMass::DETAIL_REDUCED);
+	std::map<std::pair<unsigned, int>, CachedChunk> cache;
+
+	double worst = 0.0;
+	bool covered = true;
+	int reused = 0;
+	FrameSnapshot frame;
+	for (int step = 0; step < 3000; ++step)
+	{
+		updateParticleSystems(psystems, FRAME_DT);
+		snapshotParticleSystems(psystems, frame);
+		for (int i = 0; i < psystems.size(); ++i)
+			psystems[i]->clearDirty();
+		if (step % 3 != 0)
+			continue;
+
+		std::vector<int> particleUses(frame.particles.size(), 0);
+		std::vector<int> springUses(frame.springs.size(), 0);
+		for (int c = 0; c < frame.chunks.size(); ++c)
+		{
+			const ChunkSnapshot & cs = frame.chunks[c];
+			for (int i = 0; i < cs.particleCount; ++i)
+				++particleUses[cs.firstParticle + i];
+			for (int i = 0; i < cs.springCount; ++i)
+				++springUses[cs.firstSpring + i];
+
+			CachedChunk & cached = cache[std::make_pair(cs.system, cs.chunk)];
+			if (cached.pos.empty() || cached.version != cs.version)
+			{
+				cached.version = cs.version;
+				cached.pos.clear();
+				for (int i = 0; i < cs.particleCount; ++i)
+					cached.pos.push_back(frame.particles[cs.firstParticle + i].pos);
+				continue;
+			}
+
+			++reused;
+			covered = covered && cached.pos.size() == cs.particleCount;
+			for (int i = 0; i < cs.particleCount && i < cached.pos.size(); ++i)
+			{
+				Vector3 d = cached.pos[i] - frame.particles[cs.firstParticle + i].pos;
+				worst = std::max(worst, d.magnitude());
+			}
+		}
+		for (int i = 0; i < particleUses.size(); ++i)
+			covered = covered && particleUses[i] == 1;
+		for (int i = 0; i < springUses.size(); ++i)
+			covered = covered && springUses[i] == 1;
+	}
+
+	CHECK(covered);
+	CHECK(reused > 0);
+	CHECK(worst <= 2.0 * psystems[0]->motionThreshold);
+
+	// Both have settled by now
+	CHECK(psystems[0]->dirty().isClean());
+	CHECK(psystems[1]->dirty().isClean());
+	for (int i = 0; i < psystems.size(); ++i)
+		delete psystems[i];
+}
+
+TEST(AddParticleMarksItsChunk)
+{
+	TimedParticleSystem ps;
+	for (int i = 0; i < DIRTY_CHUNK_SIZE + 8; ++i)
+		ps.addParticle(new Particle(Vector3(i, 0.0, 0.0)));
+	ps.clearDirty();
+	CHECK(ps.chunkCount() == 2);
+	CHECK(ps.dirty().isClean());
+	unsigned first = ps.chunkVersion(0);
+	unsigned second = ps.chunkVersion(1);
+
+	ps.addParticle(new Particle(Vector3(100.0, 5.0, 0.0)));
+	CHECK(ps.chunkVersion(0) == first);
+	CHECK(ps.chunkVersion(1) != second);
+	CHECK(ps.chunkDirty(0).isClean());
+	CHECK(!ps.chunkDirty(1).isClean());
+	CHECK(ps.chunkDirty(1).box.distance(Vector3(100.0, 5.0, 0.0)) == 0.0);
+}
+
+TEST(PushedParticlesAreMarkedBySnapshot)
+{
+	TimedParticleSystem ps;
+	for (int i = 0; i < DIRTY_CHUNK_SIZE - 2; ++i)
+		ps.addParticle(new Particle(Vector3(i, 0.0, 0.0)));
+	ps.clearDirty();
+	unsigned before = ps.chunkVersion(0);
+
+	// Straight onto the list after the last step, filling chunk 0 and starting chunk 1
+	for (int i = 0; i < 4; ++i)
+		ps.particles.push_back(new Particle(Vector3(50.0 + i, 0.0, 0.0)));
+	FrameSnapshot frame;
+	ps.snapshot(frame);
+
+	CHECK(frame.chunks.size() == 2);
+	CHECK(frame.chunks[0].particleCount == DIRTY_CHUNK_SIZE);
+	CHECK(frame.chunks[1].particleCount == 2);
+	CHECK(frame.chunks[0].version != before);
+	CHECK(!frame.chunks[0].dirty.isClean());
+	CHECK(!frame.chunks[1].dirty.isClean());
+}
+
+TEST(RemovalChangesAffectedChunks)
+{
+	TimedParticleSystem ps;
+	for (int i = 0; i < 3 * DIRTY_CHUNK_SIZE; ++i)
+		ps.addParticle(new Particle(Vector3(i, 0.0, 0.0)));
+	ps.clearDirty();
+	unsigned versions[3] = { ps.chunkVersion(0), ps.chunkVersion(1), ps.chunkVersion(2) };
+
+	// The last particle moves into slot 3
+	ps.removeParticle(3);
+	CHECK(ps.chunkVersion(0) != versions[0]);
+	CHECK(ps.chunkVersion(1) == versions[1]);
+	CHECK(ps.chunkVersion(2) != versions[2]);
+	CHECK(ps.chunkDirty(1).isClean());
+}
+
+///////////////////////
+/// External forces ///
+///////////////////////
+
+// Each particle's force is tagged with where it is, true if the tags still match
+static bool forcesMatchParticles(const ParticleSystem & ps)
+{
+	bool match = ps.externalForces.size() == ps.particles.size();
+	for (int i = 0; match && i < ps.particles.size(); ++i)
+	{
+		const Vector3 & tag = ps.externalForces[i].enviromentForce;
+		const Vector3 & pos = ps.particles[i]->pos;
+		match = tag.x == pos.x && tag.y == pos.y && tag.z == pos.z;
+	}
+	return match;
+}
+
+TEST(ExternalForcesFollowTheirParticles)
+{
+	ParticleSystemSpringMass strand(Vector3(100.0, 50.0, 0.0));
+	CHECK(strand.externalForces.size() == strand.particles.size());
+	for (int i = 0; i < strand.particles.size(); ++i)
+		strand.externalForces[i].enviromentForce = strand.particles[i]->pos;
+	strand.reorder(ParticleSystemSpringMass::REORDER_RCM);
+	CHECK(forcesMatchParticles(strand));
+
+	// Removal moves the last particle and its forces into the gap, and pushed
+	// particles get forces of their own
+	TimedParticleSystem ps;
+	for (int i = 0; i < 40; ++i)
+		ps.addParticle(new Particle(Vector3(i, 1.0, 0.0)));
+	for (int i = 0; i < ps.particles.size(); ++i)
+		ps.externalForces[i].enviromentForce = ps.particles[i]->pos;
+	ps.removeParticle(7);
+	ps.removeParticle(ps.particles.size() - 1);
+	CHECK(forcesMatchParticles(ps));
+
+	ps.particles.push_back(new Particle());
+	ps.update(0.1);
+	CHECK(forcesMatchParticles(ps));
+}
+
+TEST(BallForceIsSpentByOneStep)
+{
+	ParticleSystemSpringMass strand(Vector3(100.0, 50.0, 0.0));
+	for (int i = 0; i < strand.externalForces.size(); ++i)
+		strand.externalForces[i].ballForce = Vector3(100.0, 0.0, 0.0);
+	strand.update(FRAME_DT);
+
+	bool spent = true;
+	for (int i = 0; i < strand.externalForces.size(); ++i)
+		spent = spent && strand.externalForces[i].ballForce.dot(strand.externalForces[i].ballForce) == 0.0;
+	CHECK(spent);
+}
+
+// Momentum one ball hit gives the first free particle of a strand stepped
+// adaptively with some time already owed. The springs are slackened so the push
+// is the only sideways force
+static double ballImpulse(double owed)
+{
+	ParticleSystemSpringMass strand(Vector3(100.0, 50.0, 0.0));
+	strand.colliders = NULL;
+	for (int i = 0; i < strand.springConnections.size(); ++i)
+		strand.springConnections[i].stiffness = strand.springConnections[i].damp = 0.0;
+	int i = 0;
+	while (strand.particles[i]->isLocked)
+		++i;
+
+	strand.pendingTime = owed;
+	strand.externalForces[i].ballForce = Vector3(100.0, 0.0, 0.0);
+	Particle before = *strand.particles[i];
+	// Small steps so the frame is always split
+	stepParticleSystem(&strand, FRAME_DT, TimestepLimits(0.002, 0.01), 0.0);
+	CHECK(strand.pendingTime == 0.0);
+	return before.mass * (strand.particles[i]->vel.x - before.vel.x);
+}
+
+TEST(BallImpulseDoesNotDependOnOwedTime)
+{
+	double fresh = ballImpulse(0.0);
+	CHECK_NEAR(fresh, 100.0 * FRAME_DT, 1e-9);
+	CHECK_NEAR(ballImpulse(FRAME_DT), fresh, 1e-9);
+	CHECK_NEAR(ballImpulse(0.0013), fresh, 1e-9);
+}
+
+/////////////////////
+/// Spring forces ///
+/////////////////////
+
+TEST(GatherMatchesScatter)
+{
+	// A ball pushes both strands for the first frames so the springs do some work
+	ParticleSystemSpringMass scatter(Vector3(100.0, 50.0, 0.0));
+	ParticleSystemSpringMass gather(Vector3(100.0, 50.0, 0.0));
+	CHECK(!scatter.gatherForces);
+	gather.gatherForces = true;
+
+	double worst = 0.0;
+	for (int step = 0; step < 200; ++step)
+	{
+		for (int i = 0; step < 10 && i < scatter.particles.size(); ++i)
+		{
+			scatter.externalForces[i].ballForce = Vector3(400.0, 0.0, 0.0);
+			gather.externalForces[i].ballForce = Vector3(400.0, 0.0, 0.0);
+		}
+		scatter.update(FRAME_DT);
+		gather.update(FRAME_DT);
+		for (int i = 0; i < scatter.particles.size(); ++i)
+			worst = std::max(worst, (scatter.particles[i]->pos - gather.particles[i]->pos).magnitude());
+	}
+	// Only the order the forces are summed in differs
+	CHECK(worst < 1e-9);
+}
+
+///////////////////////
+/// Level of detail ///
+///////////////////////
+
+// A ball pushes a weed on the floor, as main.cpp spawns them, for its first frames
+static void pushWeed(ParticleSystemSpringMass & weed, int frame)
+{
+	for (int i = 0; frame < 5 && i < weed.particles.size(); ++i)
+		weed.externalForces[i].ballForce += Vector3(300.0, 0.0, 0.0);
+}
+
+static std::vector<Vector3> positions(const ParticleSystem & ps)
+{
+	std::vector<Vector3> pos;
+	for (int i = 0; i < ps.particles.size(); ++i)
+		pos.push_back(ps.particles[i]->pos);
+	return pos;
+}
+
+// Furthest any particle is from where it was
+static double largestMove(const ParticleSystem & ps, const std::vector<Vector3> & from)
+{
+	double worst = 0.0;
+	for (int i = 0; i < ps.particles.size(); ++i)
+		worst = std::max(worst, (ps.particles[i]->pos - from[i]).magnitude());
+	return worst;
+}
+
+TEST(ReducedDetailFollowsFullDetail)
+{
+	ParticleSystemSpringMass full(Vector3(100.0, 0.0, 0.0));
+	ParticleSystemSpringMass reduced(Vector3(100.0, 0.0, 0.0));
+	reduced.setDetail(ParticleSystemSpringMass::DETAIL_REDUCED);
+
+	double apart = 0.0;
+	double fullMove = 0.0;
+	double reducedMove = 0.0;
+	for (int frame = 0; frame < 300; ++frame)
+	{
+		pushWeed(full, frame);
+		pushWeed(reduced, frame);
+		std::vector<Vector3> fullBefore = positions(full);
+		std::vector<Vector3> reducedBefore = positions(reduced);
+		full.update(FRAME_DT);
+		reduced.update(FRAME_DT);
+		fullMove = std::max(fullMove, largestMove(full, fullBefore));
+		reducedMove = std::max(reducedMove, largestMove(reduced, reducedBefore));
+		apart = std::max(apart, largestMove(reduced, positions(full)));
+	}
+	// A few pixels apart at most, and never moving further in a frame
+	CHECK(fullMove > 0.5);
+	CHECK(apart < 6.0);
+	CHECK(reducedMove <= fullMove);
+}
+
+TEST(PromotionMidIntervalIsContinuous)
+{
+	// Promoted on every frame of an interval but its step frame
+	for (int at = 1; at < 8; ++at)
+	{
+		ParticleSystemSpringMass weed(Vector3(100.0, 0.0, 0.0));
+		weed.setDetail(ParticleSystemSpringMass::DETAIL_REDUCED);
+		CHECK(weed.reducedInterval == 8);
+		std::vector<Vector3> previous;
+		for (int frame = 0; frame < 40 + at; ++frame)
+		{
+			pushWeed(weed, frame);
+			previous = positions(weed);
+			weed.update(FRAME_DT);
+		}
+
+		std::vector<Vector3> before = positions(weed);
+		std::vector<Vector3> velBefore;
+		for (int i = 0; i < weed.particles.size(); ++i)
+			velBefore.push_back(weed.particles[i]->vel);
+		weed.setDetail(ParticleSystemSpringMass::DETAIL_FULL);
+		CHECK(largestMove(weed, before) == 0.0);
+		weed.update(FRAME_DT);
+
+		// The first full frame moves each particle about as far as the reduced
+		// frame before it did, and its velocity only changes by a frame's forces
+		double move = 0.0;
+		double moveChange = 0.0;
+		double speed = 0.0;
+		double speedChange = 0.0;
+		for (int i = 0; i < weed.particles.size(); ++i)
+		{
+			Vector3 was = before[i] - previous[i];
+			Vector3 now = weed.particles[i]->pos - before[i];
+			move = std::max(move, was.magnitude());
+			moveChange = std::max(moveChange, (now - was).magnitude());
+			speed = std::max(speed, velBefore[i].magnitude());
+			speedChange = std::max(speedChange, (weed.particles[i]->vel - velBefore[i]).magnitude());
+		}
+		CHECK(move > 0.1);
+		CHECK(moveChange < 0.05 * move);
+		CHECK(speedChange < 0.05 * speed);
+	}
+}
+
+////////////////
+/// Spawning ///
+////////////////
+
+// True if both systems hold the same particles and springs, bit for bit
+static bool sameSystem(const ParticleSystemSpringMass & a, const ParticleSystemSpringMass & b)
+{
+	if (a.particles.size() != b.particles.size() || a.springConnections.size() != b.springConnections.size())
+		return false;
+	bool same = true;
+	for (int i = 0; i < a.particles.size(); ++i)
+	{
+		const Particle & p = *a.particles[i];
+		const Particle & q = *b.particles[i];
+		same = same && p.pos.x == q.pos.x && p.pos.y == q.pos.y && p.pos.z == q.pos.z &&
+			p.vel.x == q.vel.x && p.vel.y == q.vel.y && p.vel.z == q.vel.z &&
+			p.mass == q.mass && p.timer == q.timer && p.isLocked == q.isLocked;
+	}
+	for (int i = 0; i < a.springConnections.size(); ++i)
+	{
+		const auto & s = a.springConnections[i];
+		const auto & t = b.springConnections[i];
+		same = same && s.index1 == t.index1 && s.index2 == t.index2 && s.stiffness == t.stiffness &&
+			s.damp == t.damp && s.length == t.length &&
+			s.particle1 == a.particles[s.index1] && s.particle2 == a.particles[s.index2];
+	}
+	return same;
+}
+
+TEST(SpawnMatchesIndividualSystems)
+{
+	std::vector<ParticleSystemSpringMass::SpawnParams> params;
+	const ParticleSystemSpringMass::ReorderMethod methods[] = { ParticleSystemSpringMass::REORDER_NONE,
+		ParticleSystemSpringMass::REORDER_MORTON, ParticleSystemSpringMass::REORDER_RCM };
+	for (int i = 0; i < 7; ++i)
+		params.push_back(ParticleSystemSpringMass::SpawnParams(Vector3(100.0 * (i + 1), 20.0 * i, 0.0), 6 + i, methods[i % 3]));
+
+	// Spread over three threads so the slices of the block are built concurrently
+	std::vector<ParticleSystem*> spawned;
+	ParticleSystemSpringMass::spawn(params, spawned, 3);
+	CHECK(spawned.size() == params.size());
+
+	bool same = true;
+	for (int i = 0; i < params.size(); ++i)
+	{
+		ParticleSystemSpringMass* ps = static_cast<ParticleSystemSpringMass*>(spawned[i]);
+		ParticleSystemSpringMass alone(params[i].location, params[i].gridSize, params[i].reorderMethod);
+		same = same && sameSystem(*ps, alone);
+
+		// And they carry on the same
+		for (int step = 0; step < 50; ++step)
+		{
+			ps->update(FRAME_DT);
+			alone.update(FRAME_DT);
+		}
+		same = same && sameSystem(*ps, alone);
+	}
+	CHECK(same);
+	for (int i = 0; i < spawned.size(); ++i)
+		delete spawned[i];
+}
+
+TEST(SpawnedParticlesLiveAsLongAsTheirSystems)
+{
+	std::vector<ParticleSystemSpringMass::SpawnParams> params;
+	for (int i = 0; i < 3; ++i)
+		params.push_back(ParticleSystemSpringMass::SpawnParams(Vector3(100.0 * (i + 1), 0.0, 0.0)));
+	std::vector<ParticleSystem*> spawned;
+	ParticleSystemSpringMass::spawn(params, spawned, 2);
+
+	// The block starts with the first particle of the first system
+	const Particle* blockStart = spawned[0]->particles[0];
+	std::vector<const Particle*> inBlock;
+	for (int i = 0; i < spawned.size(); ++i)
+		inBlock.insert(inBlock.end(), spawned[i]->particles.begin(), spawned[i]->particles.end());
+	ParticleSystem* last = spawned[2];
+
+	test::watchFrees(true);
+
+	// Particles added later are freed as usual, the block's never one at a time
+	Particle* added = new Particle(Vector3(500.0, 5.0, 0.0));
+	Particle* kept = new Particle(Vector3(510.0, 5.0, 0.0));
+	ParticleHandle addedHandle = last->addParticle(added);
+	last->addParticle(kept);
+	last->removeParticle(3);
+	last->removeParticle(last->indexOf(addedHandle));
+	bool addedFreed = test::wasFreed(added);
+	bool keptFreed = test::wasFreed(kept);
+
+	// Systems going away don't take the block with them while another still uses it
+	delete spawned[0];
+	delete spawned[1];
+	bool blockFreedEarly = false;
+	for (int i = 0; i < inBlock.size(); ++i)
+		blockFreedEarly = blockFreedEarly || test::wasFreed(inBlock[i]);
+	bool lastIntact = last->particles.size() == 100 && last->particles[0]->mass == 2.0;
+
+	delete last;
+	bool keptFreedWithSystem = test::wasFreed(kept);
+	bool blockFreed = test::wasFreed(blockStart);
+	test::watchFrees(false);
+
+	CHECK(addedFreed);
+	CHECK(!keptFreed);
+	CHECK(!blockFreedEarly);
+	CHECK(lastIntact);
+	CHECK(keptFreedWithSystem);
+	CHECK(blockFreed);
+}
+
+//////////////////
+/// Reordering ///
+//////////////////
+
+// Steps a weed reordered every few steps next to an unordered one, pushing the
+// same particles of both, and returns the largest gap between particles with
+// matching handles. renumbered is set if a periodic reorder moved any particle
+// after the first one, resolved if every handle kept finding its particle
+static double reorderedDeparture(ParticleSystemSpringMass::ReorderMethod method, int interval, bool & renumbered, bool & resolved)
+{
+	ParticleSystemSpringMass plain(Vector3(100.0, 0.0, 0.0));
+	ParticleSystemSpringMass reordered(Vector3(100.0, 0.0, 0.0));
+	std::vector<ParticleHandle> plainHandles;
+	std::vector<ParticleHandle> handles;
+	for (int i = 0; i < plain.particles.size(); ++i)
+	{
+		plainHandles.push_back(plain.handle(i));
+		handles.push_back(reordered.handle(i));
+	}
+	// A current that differs from particle to particle and lasts, so it has to
+	// follow its particle through every reorder
+	for (int k = 0; k < handles.size(); ++k)
+	{
+		Vector3 current(5.0 * (k % 4), -3.0 * (k % 5), 0.0);
+		plain.externalForces[k].enviromentForce = current;
+		reordered.externalForces[k].enviromentForce = current;
+	}
+	reordered.reorderMethod = method;
+	reordered.reorderInterval = interval;
+	reordered.reorder(method);
+	std::vector<int> firstOrder;
+	for (int k = 0; k < handles.size(); ++k)
+		firstOrder.push_back(reordered.indexOf(handles[k]));
+
+	renumbered = false;
+	resolved = true;
+	double worst = 0.0;
+	for (int frame = 0; frame < 300; ++frame)
+	{
+		for (int k = 0; frame < 5 && k < handles.size(); ++k)
+		{
+			Vector3 push(300.0 + 10.0 * k, 20.0 * (k % 3), 0.0);
+			plain.externalForces[plain.indexOf(plainHandles[k])].ballForce += push;
+			reordered.externalForces[reordered.indexOf(handles[k])].ballForce += push;
+		}
+		plain.update(FRAME_DT);
+		reordered.update(FRAME_DT);
+
+		for (int k = 0; k < handles.size(); ++k)
+		{
+			const Particle* p = plain.find(plainHandles[k]);
+			const Particle* q = reordered.find(handles[k]);
+			resolved = resolved && q != NULL && q == reordered.particles[reordered.indexOf(handles[k])];
+			if (q == NULL)
+				continue;
+			renumbered = renumbered || reordered.indexOf(handles[k]) != firstOrder[k];
+			worst = std::max(worst, (p->pos - q->pos).magnitude());
+			worst = std::max(worst, (p->vel - q->vel).magnitude());
+			resolved = resolved && p->isLocked == q->isLocked && p->timer == q->timer;
+		}
+	}
+	return worst;
+}
+
+TEST(ReorderingLeavesTheSimulationAlone)
+{
+	// Only the order spring forces are summed in changes
+	bool renumbered = false;
+	bool resolved = false;
+	CHECK(reorderedDeparture(ParticleSystemSpringMass::REORDER_MORTON, 7, renumbered, resolved) < 1e-9);
+	CHECK(resolved);
+	CHECK(renumbered);
+
+	CHECK(reorderedDeparture(ParticleSystemSpringMass::REORDER_RCM, 7, renumbered, resolved) < 1e-9);
+	CHECK(resolved);
+	CHECK(renumbered);
+}
@@ -0,0 +1,167 @@
+#include "test.h"
+
+#include "../ParticleSystem/snapshot.h"
+#include "../ParticleSystem/particlesystem.h"
+
+#include <thread>
+
+// Fills a frame the way the simulation does, every particle carries the frame number
+static void fillFrame(FrameSnapshot & frame, int number, int particles)
+{
+	frame.clear();
+	frame.frame = number;
+	for (int i = 0; i < particles; ++i)
+	{
+		ParticleSnapshot ps;
+		ps.pos = Vector3(number, i, 0.0);
+		frame.particles.push_back(ps);
+	}
+}
+
+// True if every particle of the frame was written for the same frame
+static bool isWhole(const FrameSnapshot & frame, int particles)
+{
+	if (frame.particles.size() != particles)
+		return false;
+	for (int i = 0; i < frame.particles.size(); ++i)
+	{
+		if (frame.particles[i].pos.x != frame.frame || frame.particles[i].pos.y != i)
+			return false;
+	}
+	return true;
+}
+
+static bool samePos(const Vector3 & a, const Vector3 & b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+TEST(NoFrameBeforeFirstPublish)
+{
+	SnapshotBuffer buffer;
+	CHECK(!buffer.hasNewFrame());
+	CHECK(buffer.acquire().frame == 0);
+	CHECK(buffer.acquire().particles.empty());
+}
+
+TEST(AcquireTakesPublishedFrameOnce)
+{
+	SnapshotBuffer buffer;
+	fillFrame(buffer.backBuffer(), 1, 4);
+	buffer.publish();
+	CHECK(buffer.hasNewFrame());
+
+	const FrameSnapshot & frame = buffer.acquire();
+	CHECK(frame.frame == 1);
+	CHECK(isWhole(frame, 4));
+	CHECK(!buffer.hasNewFrame());
+
+	// Nothing new, the same frame again
+	CHECK(&buffer.acquire() == &frame);
+}
+
+TEST(AcquireSkipsToNewestFrame)
+{
+	SnapshotBuffer buffer;
+	for (int n = 1; n <= 5; ++n)
+	{
+		fillFrame(buffer.backBuffer(), n, 4);
+		buffer.publish();
+	}
+	CHECK(buffer.acquire().frame == 5);
+	CHECK(isWhole(buffer.acquire(), 4));
+}
+
+TEST(AcquiredFrameUnchangedWhileProducerRuns)
+{
+	SnapshotBuffer buffer;
+	fillFrame(buffer.backBuffer(), 1, 4);
+	buffer.publish();
+	const FrameSnapshot & frame = buffer.acquire();
+
+	// The producer only ever cycles through the other two buffers
+	for (int n = 2; n <= 10; ++n)
+	{
+		CHECK(&buffer.backBuffer() != &frame);
+		fillFrame(buffer.backBuffer(), n, 8);
+		buffer.publish();
+	}
+	CHECK(frame.frame == 1);
+	CHECK(isWhole(frame, 4));
+	CHECK(buffer.acquire().frame == 10);
+}
+
+TEST(ConsumerThreadOnlySeesWholeFrames)
+{
+	const int FRAMES = 20000;
+	const int PARTICLES = 64;
+	SnapshotBuffer buffer;
+
+	std::thread producer([&buffer, FRAMES, PARTICLES]()
+	{
+		for (int n = 1; n <= FRAMES; ++n)
+		{
+			fillFrame(buffer.backBuffer(), n, PARTICLES);
+			buffer.publish();
+		}
+	});
+
+	int last = 0;
+	int seen = 0;
+	bool whole = true;
+	bool ordered = true;
+	while (last < FRAMES)
+	{
+		if (!buffer.hasNewFrame())
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		const FrameSnapshot & frame = buffer.acquire();
+		whole = whole && isWhole(frame, PARTICLES);
+		ordered = ordered && frame.frame > last;
+		last = frame.frame;
+		++seen;
+	}
+	producer.join();
+
+	CHECK(whole);
+	CHECK(ordered);
+	CHECK(seen > 0);
+}
+
+TEST(SpringMassSnapshotIsSelfContained)
+{
+	ParticleSystemSpringMass strand(Vector3(100.0, 100.0, 0.0), 10);
+	FrameSnapshot frame;
+	snapshotParticleSystems(std::vector<ParticleSystem*>(1, &strand), frame);
+
+	CHECK(frame.particles.size() == strand.particles.size());
+	CHECK(frame.springs.size() == strand.springConnections.size());
+	for (int i = 0; i < frame.particles.size(); ++i)
+		CHECK(samePos(frame.particles[i].pos, strand.particles[i]->pos));
+
+	bool inRange = true;
+	for (int i = 0; i < frame.springs.size(); ++i)
+	{
+		const SpringSnapshot & s = frame.springs[i];
+		inRange = inRange && s.particle1 >= 0 && s.particle1 < frame.particles.size()
+			&& s.particle2 >= 0 && s.particle2 < frame.particles.size();
+	}
+	CHECK(inRange);
+
+	// The chunks cover every particle and spring once, in order
+	int particles = 0;
+	int springs = 0;
+	for (int c = 0; c < frame.chunks.size(); ++c)
+	{
+		const ChunkSnapshot & cs = frame.chunks[c];
+		CHECK(cs.system == strand.id());
+		CHECK(cs.firstParticle == particles);
+		CHECK(cs.firstSpring == springs);
+		particles += cs.particleCount;
+		springs += cs.springCount;
+	}
+	CHECK(particles == frame.particles.size());
+	CHECK(springs == frame.springs.size());
+}
@@ -0,0 +1,204 @@
+#include "test.h"
+
+#include "../ParticleSystem/springsolver.h"
+#include "../ParticleSystem/particlesystem.h"
+
+#include <algorithm>
+
+// A grid numbered row by row with stiff springs along its rows, columns and
+// diagonals, the first column and a few other particles locked
+struct SolverGrid
+{
+	int rows;
+	int cols;
+	std::vector<double> masses;
+	std::vector<SolverSpring> springs;
+	std::vector<int> cells;
+	std::vector<char> locked;
+	std::vector<Vector3> b;
+
+	SolverGrid(int rows, int cols)
+		: rows(rows), cols(cols)
+	{
+		const double k = 1e5;
+		const double d = 10.0;
+		for (int i = 0; i < rows; ++i)
+		{
+			for (int j = 0; j < cols; ++j)
+			{
+				int p = i * cols + j;
+				masses.push_back(1.0 + (p % 7) * 0.25);
+				cells.push_back(p);
+				locked.push_back(j == 0 || p % 37 == 5);
+				b.push_back(Vector3(std::sin(0.3 * p), std::cos(0.7 * p), 0.5 - (p % 3)));
+				if (i > 0)
+					springs.push_back(SolverSpring(p - cols, p, k, d));
+				if (j > 0)
+					springs.push_back(SolverSpring(p - 1, p, k, d));
+				if (i > 0 && j > 0)
+					springs.push_back(SolverSpring(p - cols - 1, p, k, d));
+			}
+		}
+	}
+
+	// |b - (M + h D + h^2 K) dv| / |b| over the free particles
+	double residual(double h, const std::vector<Vector3> & dv) const
+	{
+		std::vector<Vector3> r(masses.size());
+		for (int p = 0; p < masses.size(); ++p)
+			r[p] = b[p] - dv[p] * masses[p];
+		for (int s = 0; s < springs.size(); ++s)
+		{
+			const SolverSpring & sp = springs[s];
+			Vector3 f = (dv[sp.i] - dv[sp.j]) * (h * sp.damping + h * h * sp.stiffness);
+			r[sp.i] -= f;
+			r[sp.j] += f;
+		}
+		double rr = 0.0;
+		double bb = 0.0;
+		for (int p = 0; p < masses.size(); ++p)
+		{
+			if (locked[p])
+				continue;
+			rr += r[p].dot(r[p]);
+			bb += b[p].dot(b[p]);
+		}
+		return std::sqrt(rr / bb);
+	}
+};
+
+static double largestDifference(const std::vector<Vector3> & a, const std::vector<Vector3> & b)
+{
+	double worst = 0.0;
+	for (int i = 0; i < a.size(); ++i)
+		worst = std::max(worst, (a[i] - b[i]).magnitude());
+	return worst;
+}
+
+static double largest(const std::vector<Vector3> & a)
+{
+	return largestDifference(a, std::vector<Vector3>(a.size()));
+}
+
+TEST(SolverPathsAgree)
+{
+	const double h = 0.025;
+	SolverGrid grid(20, 20);
+
+	SpringSolver direct;
+	direct.build(grid.masses, grid.springs, grid.cells, grid.rows, grid.cols);
+	std::vector<Vector3> directDv;
+	CHECK(direct.solve(h, grid.b, grid.locked, directDv) == 0);
+	CHECK(grid.residual(h, directDv) < 1e-10);
+
+	SpringSolver jacobi;
+	jacobi.maxDirectSize = 0;
+	jacobi.preconditioner = SpringSolver::PRECONDITION_JACOBI;
+	jacobi.tolerance = 1e-10;
+	jacobi.maxIterations = 5000;
+	jacobi.build(grid.masses, grid.springs, grid.cells, grid.rows, grid.cols);
+	std::vector<Vector3> jacobiDv;
+	CHECK(jacobi.solve(h, grid.b, grid.locked, jacobiDv) > 0);
+
+	SpringSolver multigrid;
+	multigrid.maxDirectSize = 0;
+	multigrid.tolerance = 1e-10;
+	multigrid.build(grid.masses, grid.springs, grid.cells, grid.rows, grid.cols);
+	CHECK(multigrid.levels() > 1);
+	std::vector<Vector3> multigridDv;
+	CHECK(multigrid.solve(h, grid.b, grid.locked, multigridDv) > 0);
+	CHECK(multigrid.lastIterations() < jacobi.lastIterations());
+
+	const double scale = largest(directDv);
+	CHECK(largestDifference(jacobiDv, directDv) <= 1e-6 * scale);
+	CHECK(largestDifference(multigridDv, directDv) <= 1e-6 * scale);
+
+	// Locked particles don't move
+	bool pinned = true;
+	for (int p = 0; p < grid.locked.size(); ++p)
+	{
+		if (grid.locked[p])
+			pinned = pinned && directDv[p].dot(directDv[p]) == 0.0 &&
+				jacobiDv[p].dot(jacobiDv[p]) == 0.0 && multigridDv[p].dot(multigridDv[p]) == 0.0;
+	}
+	CHECK(pinned);
+}
+
+TEST(ConjugateGradientStopsAtTolerance)
+{
+	const double h = 0.025;
+	SolverGrid grid(20, 20);
+	const SpringSolver::Preconditioner preconditioners[] =
+		{ SpringSolver::PRECONDITION_JACOBI, SpringSolver::PRECONDITION_MULTIGRID };
+
+	for (int k = 0; k < 2; ++k)
+	{
+		SpringSolver solver;
+		solver.maxDirectSize = 0;
+		solver.maxIterations = 5000;
+		solver.preconditioner = preconditioners[k];
+		solver.build(grid.masses, grid.springs, grid.cells, grid.rows, grid.cols);
+		std::vector<Vector3> dv;
+
+		// Each tolerance is met, and one iteration fewer would not have met it
+		int previous = 0;
+		const double tolerances[] = { 1e-2, 1e-4, 1e-6, 1e-8 };
+		for (int t = 0; t < 4; ++t)
+		{
+			solver.tolerance = tolerances[t];
+			solver.maxIterations = 5000;
+			int iterations = solver.solve(h, grid.b, grid.locked, dv);
+			CHECK(solver.lastResidual() <= tolerances[t]);
+			CHECK_NEAR(grid.residual(h, dv), solver.lastResidual(), 1e-3 * tolerances[t]);
+			CHECK(iterations >= previous);
+			previous = iterations;
+
+			solver.maxIterations = iterations - 1;
+			solver.solve(h, grid.b, grid.locked, dv);
+			CHECK(solver.lastResidual() > tolerances[t]);
+		}
+
+		solver.tolerance = 1e-12;
+		solver.maxIterations = 2;
+		CHECK(solver.solve(h, grid.b, grid.locked, dv) == 2);
+		CHECK(solver.lastResidual() > 1e-12);
+	}
+}
+
+// Largest distance between a strand stepped explicitly and one stepped implicitly
+// for a second in steps of h. The strand starts out stretched so its springs work
+static double implicitDeparture(double h)
+{
+	ParticleSystemSpringMass explicitStrand(Vector3(100.0, 50.0, 0.0));
+	ParticleSystemSpringMass implicitStrand(Vector3(100.0, 50.0, 0.0));
+	implicitStrand.integrator = ParticleSystemSpringMass::INTEGRATE_IMPLICIT;
+	ParticleSystemSpringMass* strands[] = { &explicitStrand, &implicitStrand };
+	for (int s = 0; s < 2; ++s)
+	{
+		strands[s]->colliders = NULL;
+		for (int i = 0; i < strands[s]->particles.size(); ++i)
+			strands[s]->particles[i]->vel = Vector3(20.0 * std::sin(1.3 * i), 20.0 * std::cos(0.9 * i), 0.0);
+	}
+
+	const int steps = (int)(1.0 / h + 0.5);
+	for (int step = 0; step < steps; ++step)
+	{
+		explicitStrand.update(h);
+		implicitStrand.update(h);
+	}
+	double worst = 0.0;
+	for (int i = 0; i < explicitStrand.particles.size(); ++i)
+		worst = std::max(worst, (explicitStrand.particles[i]->pos - implicitStrand.particles[i]->pos).magnitude());
+	return worst;
+}
+
+TEST(ImplicitMatchesExplicitToFirstOrder)
+{
+	// Halving the step about halves the gap between the two
+	double coarse = implicitDeparture(0.01);
+	double fine = implicitDeparture(0.005);
+	double finer = implicitDeparture(0.0025);
+	CHECK(coarse > 0.0);
+	CHECK(fine / coarse > 0.4 && fine / coarse < 0.6);
+	CHECK(finer / fine > 0.4 && finer / fine < 0.6);
+}
@@ -0,0 +1,152 @@
+#include "test.h"
+
+#include "../ParticleSystem/taskgraph.h"
+#include "../ParticleSystem/particlesystem.h"
+#include "../ParticleSystem/const.h"
+
+#include <atomic>
+#include <memory>
+
+// Runs random graphs and checks that every task starts only after all the
+// tasks it depends on have finished, and that each task runs once
+static void checkRandomGraphs(TaskExecutor & executor, int graphs, int tasks)
+{
+	const int EDGES_PER_TASK = 3;
+	TaskGraph graph;
+	std::unique_ptr<std::atomic<int>[]> starts(new std::atomic<int>[tasks]);
+	std::unique_ptr<std::atomic<int>[]> ends(new std::atomic<int>[tasks]);
+	std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[tasks]);
+	std::atomic<int> stamp(0);
+
+	unsigned seed = 12345;
+	bool ordered = true;
+	bool once = true;
+	for (int g = 0; g < graphs; ++g)
+	{
+		graph.clear();
+		for (int t = 0; t < tasks; ++t)
+		{
+			starts[t] = 0;
+			ends[t] = 0;
+			runs[t] = 0;
+			std::atomic<int> * start = &starts[t];
+			std::atomic<int> * end = &ends[t];
+			std::atomic<int> * run = &runs[t];
+			std::atomic<int> * clock = &stamp;
+			graph.add([start, end, run, clock]()
+			{
+				*start = ++*clock;
+				++*run;
+				*end = ++*clock;
+			});
+		}
+
+		// Edges only go forward, so the graph has no cycles
+		std::vector<std::pair<int, int> > edges;
+		for (int t = 1; t < tasks; ++t)
+		{
+			for (int e = 0; e < EDGES_PER_TASK; ++e)
+			{
+				seed = seed * 1103515245u + 12345u;
+				if ((seed >> 16) % 2 == 0)
+					continue;
+				int before = (seed >> 8) % t;
+				graph.precede(before, t);
+				edges.push_back(std::make_pair(before, t));
+			}
+		}
+
+		executor.run(graph);
+
+		for (int t = 0; t < tasks; ++t)
+			once = once && runs[t] == 1;
+		for (int e = 0; e < edges.size(); ++e)
+			ordered = ordered && ends[edges[e].first] < starts[edges[e].second];
+	}
+	CHECK(once);
+	CHECK(ordered);
+}
+
+TEST(RandomGraphsRespectTheirEdges)
+{
+	TaskExecutor executor(4);
+	checkRandomGraphs(executor, 200, 300);
+}
+
+TEST(SingleThreadExecutorRunsGraphs)
+{
+	TaskExecutor executor(1);
+	checkRandomGraphs(executor, 20, 300);
+}
+
+TEST(EmptyGraphReturns)
+{
+	TaskExecutor executor(4);
+	TaskGraph graph;
+	executor.run(graph);
+	CHECK(graph.size() == 0);
+}
+
+TEST(GraphStepsMatchStagedUpdate)
+{
+	// The same strands stepped by the free functions and by a graph of
+	// forces -> bounds -> integrate -> cleanup per system
+	std::vector<ParticleSystemSpringMass::SpawnParams> params;
+	for (int i = 0; i < 12; ++i)
+		params.push_back(ParticleSystemSpringMass::SpawnParams(Vector3(40.0 + i * 60.0, 0.0, 0.0), 3 + i * 2));
+	std::vector<ParticleSystem*> staged;
+	std::vector<ParticleSystem*> graphed;
+	ParticleSystemSpringMass::spawn(params, staged, 1);
+	ParticleSystemSpringMass::spawn(params, graphed, 1);
+	for (int i = 0; i < staged.size(); ++i)
+	{
+		for (int k = 0; k < staged[i]->particles.size(); ++k)
+		{
+			Vector3 push((i % 3 - 1) * 80.0, 20.0, 0.0);
+			staged[i]->particles[k]->vel = push;
+			graphed[i]->particles[k]->vel = push;
+		}
+	}
+
+	TaskExecutor executor(4);
+	TaskGraph graph;
+	const double dt = FRAME_DT;
+	for (int step = 0; step < 200; ++step)
+	{
+		updateParticleSystems(staged, dt);
+		cleanupParticleSystems(staged);
+
+		graph.clear();
+		for (int i = 0; i < graphed.size(); ++i)
+		{
+			ParticleSystem* ps = graphed[i];
+			TaskGraph::Task forces = graph.add([ps, dt]() { ps->applyForces(dt); });
+			TaskGraph::Task bounds = graph.add([ps]() { ps->resolveCollisions(); });
+			TaskGraph::Task integrate = graph.add([ps, dt]() { ps->integrate(dt); });
+			TaskGraph::Task cleanup = graph.add([ps]() { ps->cleanup(); });
+			graph.precede(forces, bounds);
+			graph.precede(bounds, integrate);
+			graph.precede(integrate, cleanup);
+		}
+		executor.run(graph);
+	}
+
+	bool same = staged.size() == graphed.size();
+	for (int i = 0; same && i < staged.size(); ++i)
+	{
+		same = staged[i]->particles.size() == graphed[i]->particles.size();
+		for (int k = 0; same && k < staged[i]->particles.size(); ++k)
+		{
+			const Vector3 & a = staged[i]->particles[k]->pos;
+			const Vector3 & b = graphed[i]->particles[k]->pos;
+			same = a.x == b.x && a.y == b.y && a.z == b.z;
+		}
+	}
+	CHECK(same);
+
+	for (int i = 0; i < staged.size(); ++i)
+	{
+		delete staged[i];
+		delete graphed[i];
+	}
+}
@@ -0,0 +1,128 @@
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace test
+{
+	struct Entry
+	{
+		const char * name;
+		Function function;
+	};
+
+	// Function-local so it exists before any static Registration runs
+	static std::vector<Entry> & registry()
+	{
+		static std::vector<Entry> entries;
+		return entries;
+	}
+
+	static int failures = 0;
+
+	Registration::Registration(const char * name, Function function)
+	{
+		Entry e = { name, function };
+		registry().push_back(e);
+	}
+
+	void fail(const char * file, int line, const char * expression)
+	{
+		printf("  %s:%d: CHECK(%s) failed\n", file, line, expression);
+		++failures;
+	}
+
+	static const char * option(const char * arg, const char * name)
+	{
+		size_t n = strlen(name);
+		if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+			return arg + n + 1;
+		return NULL;
+	}
+
+	int runTests(int argc, char ** argv)
+	{
+		std::string filter;
+		for (int i = 1; i < argc; ++i)
+		{
+			const char * value;
+			if ((value = option(argv[i], "--filter")))
+				filter = value;
+			else
+			{
+				fprintf(stderr, "usage: %s [--filter=<substring>]\n", argv[0]);
+				return 1;
+			}
+		}
+
+		int run = 0;
+		int failed = 0;
+		const std::vector<Entry> & tests = registry();
+		for (int i = 0; i < tests.size(); ++i)
+		{
+			if (!filter.empty() && std::string(tests[i].name).find(filter) == std::string::npos)
+				continue;
+			int before = failures;
+			tests[i].function();
+			++run;
+			if (failures != before)
+				++failed;
+			printf("%-48s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+			fflush(stdout);
+		}
+		printf("%d tests, %d failed\n", run, failed);
+		return failed == 0 ? 0 : 1;
+	}
+
+	// Fixed size, operator delete can't allocate
+	static const int MAX_FREES = 4096;
+	static bool watching = false;
+	static const void * freed[MAX_FREES];
+	static int freedCount = 0;
+
+	void watchFrees(bool on)
+	{
+		if (on)
+			freedCount = 0;
+		watching = on;
+	}
+
+	bool wasFreed(const void * p)
+	{
+		for (int i = 0; i < freedCount; ++i)
+			if (freed[i] == p)
+				return true;
+		return false;
+	}
+
+	static void noteFree(const void * p)
+	{
+		if (watching && p != NULL && freedCount < MAX_FREES)
+			freed[freedCount++] = p;
+	}
+}
+
+// Replaced as telemetry.cpp does, delete reports to watchFrees and new is
+// replaced along with it so the two always match
+void * operator new(std::size_t size)
+{
+	void * p = std::malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) throw()
+{
+	test::noteFree(p);
+	std::free(p);
+}
+
+int main(int argc, char ** argv)
+{
+	return test::runTests(argc, argv);
+}
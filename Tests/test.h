@@ -0,0 +1,50 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <cmath>
+
+// A minimal test harness in the style of Benchmark/benchmark.h. Tests are
+// plain functions registered with the TEST macro, a failed CHECK reports
+// itself and the test carries on:
+//
+//	TEST(SomethingWorks)
+//	{
+//		CHECK(something() == 1);
+//		CHECK_NEAR(value(), 0.5, 1e-9);
+//	}
+//
+// The runner accepts --filter=<substring> and exits with 1 if any test failed.
+// Nothing here needs a window, the tests only use the simulation side
+namespace test
+{
+	typedef void (*Function)();
+
+	// Adds a test to the registry, one static instance per TEST
+	struct Registration
+	{
+		Registration(const char * name, Function function);
+	};
+
+	// Records a failed check of the running test
+	void fail(const char * file, int line, const char * expression);
+
+	int runTests(int argc, char ** argv);
+
+	// Records every address freed through the global operator delete while on,
+	// turning it on forgets the ones seen before. For tests of who frees what
+	void watchFrees(bool on);
+	bool wasFreed(const void * p);
+}
+
+#define TEST(name) \
+	static void name(); \
+	static test::Registration name##Registration(#name, name); \
+	static void name()
+
+#define CHECK(expression) \
+	do { if (!(expression)) test::fail(__FILE__, __LINE__, #expression); } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+	CHECK(std::abs((a) - (b)) <= (tolerance))
+
+#endif